@@ -0,0 +1,171 @@
+﻿#include "BitGrid.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace Pathfinding {
+
+    void BitGrid::build(const OccupancyGrid& grid)
+    {
+        m_w = grid.width();
+        m_h = grid.height();
+        m_rowWords = (m_w + 63) / 64;
+        m_colWords = (m_h + 63) / 64;
+        m_rows.assign(size_t(m_h) * size_t(m_rowWords), 0);
+        m_cols.assign(size_t(m_w) * size_t(m_colWords), 0);
+        if (empty()) return;
+
+        // 行ごと・64行の帯ごとに書き込む語が重ならないため並列に詰める
+        parallelFor(0, m_h, [&](int y) { packRow(grid, y, 0, m_rowWords - 1); }, 64);
+        parallelFor(0, m_colWords, [&](int band) { packColumns(grid, band, 0, m_w - 1); });
+    }
+
+    void BitGrid::update(const OccupancyGrid& grid, const QRect& region)
+    {
+        if (grid.width() != m_w || grid.height() != m_h) {
+            build(grid);
+            return;
+        }
+        const QRect r = region.intersected(QRect(0, 0, m_w, m_h));
+        if (r.isEmpty()) return;
+        for (int y = r.top(); y <= r.bottom(); ++y) {
+            packRow(grid, y, r.left() >> 6, r.right() >> 6);
+        }
+        for (int band = r.top() >> 6; band <= (r.bottom() >> 6); ++band) {
+            packColumns(grid, band, r.left(), r.right());
+        }
+    }
+
+    void BitGrid::clear()
+    {
+        m_rows.clear();
+        m_rows.shrink_to_fit();
+        m_cols.clear();
+        m_cols.shrink_to_fit();
+        m_w = m_h = m_rowWords = m_colWords = 0;
+    }
+
+    void BitGrid::packRow(const OccupancyGrid& grid, int y, int firstWord, int lastWord)
+    {
+        const uint8_t* row = &grid.at(0, y);
+        uint64_t* words = &m_rows[size_t(y) * size_t(m_rowWords)];
+        for (int i = firstWord; i <= lastWord; ++i) {
+            const int x0 = i * 64;
+            const int n = std::min(64, m_w - x0);
+            uint64_t word = 0;
+            for (int k = 0; k < n; ++k) {
+                word |= uint64_t(row[x0 + k] != 0) << k;
+            }
+            words[i] = word;
+        }
+    }
+
+    void BitGrid::packColumns(const OccupancyGrid& grid, int band, int x0, int x1)
+    {
+        // 帯の行を順に読み、各列の語に1ビットずつ足す (グリッドは行方向に連続して読む)
+        for (int x = x0; x <= x1; ++x) m_cols[size_t(x) * size_t(m_colWords) + size_t(band)] = 0;
+        const int y0 = band * 64;
+        const int n = std::min(64, m_h - y0);
+        for (int k = 0; k < n; ++k) {
+            const uint8_t* row = &grid.at(0, y0 + k);
+            for (int x = x0; x <= x1; ++x) {
+                m_cols[size_t(x) * size_t(m_colWords) + size_t(band)] |= uint64_t(row[x] != 0) << k;
+            }
+        }
+    }
+
+    namespace {
+        // words のビット b0..b1 (両端を含む) に 1 があるか
+        bool anyInRange(const uint64_t* words, int b0, int b1)
+        {
+            const int w0 = b0 >> 6;
+            const int w1 = b1 >> 6;
+            const uint64_t lo = ~0ull << (b0 & 63);
+            const uint64_t hi = ~0ull >> (63 - (b1 & 63));
+            if (w0 == w1) return (words[w0] & lo & hi) != 0;
+            if (words[w0] & lo) return true;
+            for (int w = w0 + 1; w < w1; ++w) {
+                if (words[w]) return true;
+            }
+            return (words[w1] & hi) != 0;
+        }
+
+        // a / b の切り上げ (b > 0)。a <= 0 なら 0
+        int ceilSteps(int a, int b)
+        {
+            return a <= 0 ? 0 : (a + b - 1) / b;
+        }
+    }
+
+    bool BitGrid::anyInRow(int y, int x0, int x1) const
+    {
+        return anyInRange(&m_rows[size_t(y) * size_t(m_rowWords)], x0, x1);
+    }
+
+    bool BitGrid::anyInColumn(int x, int y0, int y1) const
+    {
+        return anyInRange(&m_cols[size_t(x) * size_t(m_colWords)], y0, y1);
+    }
+
+    bool BitGrid::lineFree(const QPoint& p1, const QPoint& p2) const
+    {
+        if (p1.x() < 0 || p1.x() >= m_w || p1.y() < 0 || p1.y() >= m_h) return false;
+        if (p2.x() < 0 || p2.x() >= m_w || p2.y() < 0 || p2.y() >= m_h) return false;
+
+        // Pathfinder::isGridCollisionFree と同じ誤差項 err の Bresenham を、1セルずつではなく区間単位で進める
+        // 各反復は err から e2 = 2 * err を求め、e2 >= dy なら x、e2 <= dx なら y を進める
+        int x = p1.x(), y = p1.y();
+        const int x2 = p2.x(), y2 = p2.y();
+        const int dx = std::abs(x2 - x), dy = -std::abs(y2 - y);
+        const int sx = (x < x2) ? 1 : -1;
+        const int sy = (y < y2) ? 1 : -1;
+        int err = dx + dy;
+
+        if (dx >= -dy) {
+            // 緩やかな直線: y が進む反復までは x だけが進むので、その間のセルは同じ行に並ぶ
+            while (true) {
+                int t = std::abs(x2 - x);
+                if (dy != 0) t = std::min(t, ceilSteps(2 * err - dx, -2 * dy));
+                const int xe = x + sx * t;
+                if (anyInRow(y, std::min(x, xe), std::max(x, xe))) return false;
+
+                // 区間の最後のセルでの反復
+                err += t * dy;
+                if (xe == x2 && y == y2) return true;
+                const int e2 = 2 * err;
+                x = xe;
+                if (e2 >= dy) {
+                    if (x == x2) return true;
+                    err += dy; x += sx;
+                }
+                if (e2 <= dx) {
+                    if (y == y2) return true;
+                    err += dx; y += sy;
+                }
+            }
+        }
+        else {
+            // 急な直線: x が進む反復までは y だけが進むので、その間のセルは同じ列に並ぶ (転置したビット列で調べる)
+            while (true) {
+                int t = std::abs(y2 - y);
+                if (dx != 0) t = std::min(t, ceilSteps(dy - 2 * err, 2 * dx));
+                const int ye = y + sy * t;
+                if (anyInColumn(x, std::min(y, ye), std::max(y, ye))) return false;
+
+                err += t * dx;
+                if (x == x2 && ye == y2) return true;
+                const int e2 = 2 * err;
+                y = ye;
+                if (e2 >= dy) {
+                    if (x == x2) return true;
+                    err += dy; x += sx;
+                }
+                if (e2 <= dx) {
+                    if (y == y2) return true;
+                    err += dx; y += sy;
+                }
+            }
+        }
+    }
+
+}
@@ -0,0 +1,54 @@
+﻿#ifndef BITGRID_H
+#define BITGRID_H
+
+#include <QPoint>
+#include <QRect>
+#include <vector>
+#include <cstdint>
+#include "Grid.h"
+
+namespace Pathfinding {
+
+    // 占有グリッドの1ビット版 (1セル1ビット、行方向の64セルを1語に詰める)
+    // 同じ行の連続したセルを語単位でまとめて調べられるため、視線判定の走査に使う
+    // 縦に長い区間用に、列方向に詰めた (転置した) ビット列も持つ
+    class BitGrid
+    {
+    public:
+        // grid (0:通行可, それ以外:障害物) の余白を除いた範囲から生成する
+        void build(const OccupancyGrid& grid);
+        // grid の region 内が変わった時に、region に掛かる語だけを詰め直す
+        void update(const OccupancyGrid& grid, const QRect& region);
+        void clear();
+
+        bool empty() const { return m_w == 0 || m_h == 0; }
+        int width() const { return m_w; }
+        int height() const { return m_h; }
+        size_t memoryBytes() const { return (m_rows.size() + m_cols.size()) * sizeof(uint64_t); }
+
+        bool test(int x, int y) const { return (m_rows[size_t(y) * m_rowWords + size_t(x >> 6)] >> (x & 63)) & 1u; }
+
+        // 行 y の x0..x1 / 列 x の y0..y1 (両端を含む) に障害物があるか
+        bool anyInRow(int y, int x0, int x1) const;
+        bool anyInColumn(int x, int y0, int y1) const;
+
+        // p1 から p2 への Bresenham 直線上のセルが全て通行可能か (Pathfinder の視線判定と同じセルを通る)
+        // 直線を同じ行 (急な直線は同じ列) に並ぶセルの区間に分け、区間ごとに語単位で調べる
+        bool lineFree(const QPoint& p1, const QPoint& p2) const;
+
+    private:
+        // 行 y の語 firstWord..lastWord / 64行の帯 band の列 x0..x1 を grid から詰め直す
+        void packRow(const OccupancyGrid& grid, int y, int firstWord, int lastWord);
+        void packColumns(const OccupancyGrid& grid, int band, int x0, int x1);
+
+        int m_w = 0;
+        int m_h = 0;
+        int m_rowWords = 0; // 1行の語数
+        int m_colWords = 0; // 1列の語数
+        std::vector<uint64_t> m_rows; // 行 y の語 i は m_rows[y * m_rowWords + i] (ビット k が x = i * 64 + k)
+        std::vector<uint64_t> m_cols; // 列 x の語 i は m_cols[x * m_colWords + i] (ビット k が y = i * 64 + k)
+    };
+
+}
+
+#endif // BITGRID_H
@@ -0,0 +1,241 @@
+﻿#include "DStarLite.h"
+#include <algorithm>
+
+namespace Pathfinding {
+
+    namespace {
+        constexpr int StraightCost = 10;
+        constexpr int DiagonalCost = 15;
+
+        // 向き d の逆向きは d ^ 1
+        const int Dx[] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+        const int Dy[] = { 1, -1, 0, 0, 1, -1, -1, 1 };
+
+        int octile(const QPoint& a, const QPoint& b)
+        {
+            const int dx = std::abs(a.x() - b.x());
+            const int dy = std::abs(a.y() - b.y());
+            return 10 * (dx + dy) + (14 - 2 * 10) * std::min(dx, dy);
+        }
+    }
+
+    void DStarLite::reset(const QPoint& start, const QPoint& goal, int corridor)
+    {
+        m_start = start;
+        m_goal = goal;
+        m_corridor = corridor;
+        m_w = m_h = 0;
+        m_pages.clear();
+        m_queue = decltype(m_queue)();
+        m_dirty.clear();
+    }
+
+    void DStarLite::invalidate(const QRect& cells)
+    {
+        if (m_w > 0 && !cells.isEmpty()) m_dirty.push_back(cells);
+    }
+
+    DStarLite::Node* DStarLite::find(int idx) const
+    {
+        Page* page = m_pages[size_t(idx >> PageShift)].get();
+        return page ? &page->nodes[idx & (PageSize - 1)] : nullptr;
+    }
+
+    DStarLite::Node& DStarLite::node(int idx)
+    {
+        std::unique_ptr<Page>& page = m_pages[size_t(idx >> PageShift)];
+        if (!page) page.reset(new Page());
+        return page->nodes[idx & (PageSize - 1)];
+    }
+
+    int DStarLite::gOf(int idx) const
+    {
+        const Node* n = find(idx);
+        return n ? n->g : Inf;
+    }
+
+    int DStarLite::rhsOf(int idx) const
+    {
+        const Node* n = find(idx);
+        return n ? n->rhs : Inf;
+    }
+
+    bool DStarLite::inCorridor(int idx) const
+    {
+        if (m_corridor <= 0) return true;
+        const QPoint p = m_grid->pointAt(idx);
+        return octile(m_start, p) + octile(p, m_goal) <= m_corridor;
+    }
+
+    int DStarLite::edgeCost(int from, int dir) const
+    {
+        const uint8_t* occ = m_grid->data();
+        const int to = from + m_offset[dir];
+        if (occ[from] != 0 || occ[to] != 0) return -1;
+        if (dir >= 4 && (occ[from + Dx[dir]] != 0 || occ[from + m_offset[dir] - Dx[dir]] != 0)) return -1;
+        if (!inCorridor(from) || !inCorridor(to)) return -1;
+        int c = (dir < 4) ? StraightCost : DiagonalCost;
+        if (m_stepCost) c += int(m_stepCost[to]);
+        return c;
+    }
+
+    void DStarLite::updateVertex(int idx, Node& n)
+    {
+        if (n.g == n.rhs) {
+            n.queued = false;
+            return;
+        }
+        // キーが変わった場合は新しいエントリを積み、古いものは取り出す時に捨てる
+        const int k2 = std::min(n.g, n.rhs);
+        const uint32_t k1 = uint32_t(k2 + octile(m_start, m_grid->pointAt(idx)));
+        if (n.queued && n.key == k1) return;
+        n.key = k1;
+        n.queued = true;
+        m_queue.push({ k1, uint32_t(k2), idx });
+    }
+
+    void DStarLite::computeRhs(int idx)
+    {
+        // 後続セルの g から rhs を求め直す (到達不可で状態も無いセルは作らない)
+        int best = Inf;
+        for (int d = 0; d < 8; ++d) {
+            const int c = edgeCost(idx, d);
+            if (c < 0) continue;
+            const int g = gOf(idx + m_offset[d]);
+            if (g < Inf) best = std::min(best, c + g);
+        }
+        Node* n = find(idx);
+        if (!n) {
+            if (best == Inf) return;
+            n = &node(idx);
+        }
+        n->rhs = best;
+        updateVertex(idx, *n);
+    }
+
+    bool DStarLite::topBefore(const Node& start)
+    {
+        // 古くなったエントリ (キー更新前のもの・整合済みのもの) を捨ててから先頭のキーを比べる
+        while (!m_queue.empty()) {
+            const Entry& e = m_queue.top();
+            const Node* n = find(e.idx);
+            if (n && n->queued && n->key == e.k1) break;
+            m_queue.pop();
+        }
+        if (m_queue.empty()) return false;
+        const uint32_t s2 = uint32_t(std::min(start.g, start.rhs));
+        const Entry& e = m_queue.top();
+        return e.k1 != s2 ? e.k1 < s2 : e.k2 < s2;
+    }
+
+    bool DStarLite::computeShortestPath(int* expansions, const std::atomic<bool>* cancel)
+    {
+        const int startIdx = m_grid->index(m_start);
+        const int goalIdx = m_grid->index(m_goal);
+        const Node& start = node(startIdx);
+        int count = 0;
+
+        while (topBefore(start) || start.g != start.rhs) {
+            if (m_queue.empty()) break;
+            if (cancel && (++count & (CancelCheckInterval - 1)) == 0 && cancel->load(std::memory_order_relaxed)) return false;
+            const int idx = m_queue.top().idx;
+            m_queue.pop();
+            Node& n = node(idx);
+            n.queued = false;
+            if (expansions) ++*expansions;
+
+            if (n.g > n.rhs) {
+                // コストが下がった: 前のセルの rhs はこのセル経由で下がる場合だけ更新すればよい
+                n.g = n.rhs;
+                for (int d = 0; d < 8; ++d) {
+                    const int p = idx - m_offset[d];
+                    if (p == goalIdx) continue;
+                    const int c = edgeCost(p, d);
+                    if (c < 0) continue;
+                    Node& pn = node(p);
+                    if (c + n.g < pn.rhs) {
+                        pn.rhs = c + n.g;
+                        updateVertex(p, pn);
+                    }
+                }
+            }
+            else {
+                // コストが上がった: このセル経由で rhs が決まっていたセルを求め直す
+                const int oldG = n.g;
+                n.g = Inf;
+                if (idx != goalIdx) computeRhs(idx);
+                else updateVertex(idx, n);
+                for (int d = 0; d < 8; ++d) {
+                    const int p = idx - m_offset[d];
+                    if (p == goalIdx) continue;
+                    const int c = edgeCost(p, d);
+                    if (c >= 0 && rhsOf(p) == c + oldG) computeRhs(p);
+                }
+            }
+        }
+        return true;
+    }
+
+    QList<QPoint> DStarLite::plan(const OccupancyGrid& grid, const uint32_t* stepCost, int* expansions, const std::atomic<bool>* cancel)
+    {
+        if (expansions) *expansions = 0;
+        if (!grid.contains(m_start) || !grid.contains(m_goal)) return {};
+
+        m_grid = &grid;
+        m_stepCost = stepCost;
+        for (int d = 0; d < 8; ++d) m_offset[d] = Dy[d] * grid.stride() + Dx[d];
+
+        const int startIdx = grid.index(m_start);
+        const int goalIdx = grid.index(m_goal);
+
+        if (m_w == 0) {
+            // 初回: 終点から探索を始める
+            m_w = grid.width();
+            m_h = grid.height();
+            m_pages.resize(size_t(grid.size() >> PageShift) + 1);
+            Node& goal = node(goalIdx);
+            goal.rhs = 0;
+            updateVertex(goalIdx, goal);
+        }
+        else {
+            // 変化したセルと、それに接する辺を持つセルの rhs を求め直す
+            const QRect bounds(0, 0, m_w, m_h);
+            for (const QRect& cells : m_dirty) {
+                const QRect r = cells.adjusted(-1, -1, 1, 1).intersected(bounds);
+                for (int y = r.top(); y <= r.bottom(); ++y) {
+                    for (int x = r.left(); x <= r.right(); ++x) {
+                        const int idx = grid.index(x, y);
+                        if (idx != goalIdx) computeRhs(idx);
+                    }
+                }
+            }
+        }
+        m_dirty.clear();
+
+        if (!computeShortestPath(expansions, cancel)) return {};
+
+        // 始点から、後続セルのうち (辺のコスト + g) が最小のものをたどる
+        QList<QPoint> path;
+        if (gOf(startIdx) >= Inf) return path;
+        path.append(m_start);
+        const int maxSteps = m_w * m_h;
+        for (int cur = startIdx; cur != goalIdx;) {
+            int next = -1;
+            int best = Inf;
+            for (int d = 0; d < 8; ++d) {
+                const int c = edgeCost(cur, d);
+                if (c < 0) continue;
+                const int g = gOf(cur + m_offset[d]);
+                if (g < Inf && c + g < best) {
+                    best = c + g;
+                    next = cur + m_offset[d];
+                }
+            }
+            if (next < 0 || path.size() > maxSteps) return {};
+            cur = next;
+            path.append(grid.pointAt(cur));
+        }
+        return path;
+    }
+
+}
@@ -0,0 +1,102 @@
+﻿#ifndef DSTARLITE_H
+#define DSTARLITE_H
+
+#include <QPoint>
+#include <QRect>
+#include <QList>
+#include <queue>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include "Grid.h"
+
+namespace Pathfinding {
+
+    // D* Lite による区間単位の差分再計画
+    // 終点側から各セルの「終点までのコスト」を求めて保持し、セルの通行可否・追加コストが変わった時は
+    // 変化した範囲に接するセルから不整合を伝播させて修正する (変化の影響が無い部分は再探索しない)
+    // 区間の始点は動かないため、始点移動時の補正値 (km) は扱わない
+    //
+    // 辺のコストは Pathfinder と同じ (直進 10・斜め 15 + 進入セルの追加コスト stepCost、角の通り抜け不可、迂回範囲の制限あり)
+    // 状態はセル番号の連続した範囲 (ページ) ごとに、訪れた範囲だけを確保して疎に保持する
+    // (区間ごとにマップ全体の配列を持たないため)
+    class DStarLite
+    {
+    public:
+        // 始点・終点を設定し、保持している状態を破棄する
+        // corridor が 0 より大きければ、始点・終点までの octile 距離の和がこれを超えるセルは通れないものとする
+        // (Pathfinder の迂回範囲の制限と同じ楕円コリドー)
+        void reset(const QPoint& start, const QPoint& goal, int corridor = 0);
+
+        // cells 内の通行可否・追加コストが変わったことを通知する (次の plan() で反映する)
+        void invalidate(const QRect& cells);
+
+        // 経路を求める。前回から grid・stepCost が変わった範囲は invalidate() で通知済みであること
+        // 見つからなければ空のリスト。expansions には展開したセル数を返す
+        // cancel が true になったら修正を途中で止めて空のリストを返す (状態は次回の plan() で続きから修正する)
+        QList<QPoint> plan(const OccupancyGrid& grid, const uint32_t* stepCost, int* expansions = nullptr, const std::atomic<bool>* cancel = nullptr);
+
+        const QPoint& start() const { return m_start; }
+        const QPoint& goal() const { return m_goal; }
+        int corridor() const { return m_corridor; }
+        // 状態を持っているか (reset() の後で plan() したか)
+        bool planned() const { return m_w > 0; }
+        bool matches(const OccupancyGrid& grid) const { return m_w == grid.width() && m_h == grid.height(); }
+
+    private:
+        static constexpr int Inf = INT32_MAX / 2;
+        static constexpr int CancelCheckInterval = 256; // 中止要求を確認する展開数の間隔 (2の累乗)
+
+        struct Node {
+            int g = Inf;
+            int rhs = Inf;
+            uint32_t key = 0;    // キューに積んだ時の第1キー (h が固定なので第2キーもこれで決まる)
+            bool queued = false; // キュー内のエントリのうち、key と一致するものが有効
+        };
+
+        static constexpr int PageShift = 12;
+        static constexpr int PageSize = 1 << PageShift;
+        struct Page {
+            Node nodes[PageSize];
+        };
+
+        struct Entry {
+            uint32_t k1;
+            uint32_t k2;
+            int idx;
+            bool operator>(const Entry& o) const { return k1 != o.k1 ? k1 > o.k1 : k2 > o.k2; }
+        };
+
+        // idx のセルの状態 (find は未確保なら nullptr、node は必要ならページを確保する)
+        Node* find(int idx) const;
+        Node& node(int idx);
+        int gOf(int idx) const;
+        int rhsOf(int idx) const;
+
+        void computeRhs(int idx);
+        void updateVertex(int idx, Node& n);
+        bool computeShortestPath(int* expansions, const std::atomic<bool>* cancel);
+        bool topBefore(const Node& start);
+
+        // from → to の辺のコスト (通れなければ -1)
+        int edgeCost(int from, int dir) const;
+        bool inCorridor(int idx) const;
+
+        QPoint m_start;
+        QPoint m_goal;
+        int m_corridor = 0;
+        int m_w = 0;
+        int m_h = 0;
+        const OccupancyGrid* m_grid = nullptr;
+        const uint32_t* m_stepCost = nullptr;
+        int m_offset[8] = {};
+
+        std::vector<std::unique_ptr<Page>> m_pages;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> m_queue;
+        std::vector<QRect> m_dirty;
+    };
+
+}
+
+#endif // DSTARLITE_H
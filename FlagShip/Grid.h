@@ -0,0 +1,154 @@
+﻿#ifndef GRID_H
+#define GRID_H
+
+#include <QPoint>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+namespace Pathfinding {
+
+    // 行優先 (row-major) で連続確保される2次元グリッド
+    // 外周に pad セル分の余白を持たせることで、近傍参照時の範囲チェックを省略できる
+    // 同じ幅・高さ・余白で確保したグリッド同士は index() が共通になる
+    template <typename T>
+    class Grid
+    {
+    public:
+        Grid() = default;
+
+        // w x h の領域を fill で、余白を padFill で初期化する
+        void assign(int w, int h, T fill, int pad = 0, T padFill = T()) {
+            m_w = std::max(0, w);
+            m_h = std::max(0, h);
+            m_pad = std::max(0, pad);
+            m_stride = m_w + 2 * m_pad;
+            const size_t rows = size_t(m_h) + 2 * size_t(m_pad);
+            m_data.assign(rows * size_t(m_stride), padFill);
+            if (m_pad == 0) {
+                std::fill(m_data.begin(), m_data.end(), fill);
+                return;
+            }
+            for (int y = 0; y < m_h; ++y) {
+                T* row = &m_data[size_t(index(0, y))];
+                std::fill(row, row + m_w, fill);
+            }
+        }
+
+        void clear() {
+            m_data.clear();
+            m_data.shrink_to_fit();
+            m_w = m_h = m_pad = m_stride = 0;
+        }
+
+        bool empty() const { return m_w == 0 || m_h == 0; }
+        int width() const { return m_w; }
+        int height() const { return m_h; }
+        int pad() const { return m_pad; }
+        int stride() const { return m_stride; }
+
+        // 余白込みのセル数
+        int size() const { return int(m_data.size()); }
+        size_t memoryBytes() const { return m_data.size() * sizeof(T); }
+
+        bool contains(int x, int y) const { return x >= 0 && x < m_w && y >= 0 && y < m_h; }
+        bool contains(const QPoint& p) const { return contains(p.x(), p.y()); }
+
+        // 余白を考慮した線形インデックス (余白内の座標 -pad..w+pad-1 も可)
+        int index(int x, int y) const { return (y + m_pad) * m_stride + (x + m_pad); }
+        int index(const QPoint& p) const { return index(p.x(), p.y()); }
+        QPoint pointAt(int idx) const { return QPoint(idx % m_stride - m_pad, idx / m_stride - m_pad); }
+
+        T& at(int x, int y) { return m_data[size_t(index(x, y))]; }
+        const T& at(int x, int y) const { return m_data[size_t(index(x, y))]; }
+        T& operator[](int idx) { return m_data[size_t(idx)]; }
+        const T& operator[](int idx) const { return m_data[size_t(idx)]; }
+
+        T* data() { return m_data.data(); }
+        const T* data() const { return m_data.data(); }
+
+    private:
+        std::vector<T> m_data;
+        int m_w = 0;
+        int m_h = 0;
+        int m_pad = 0;
+        int m_stride = 0;
+    };
+
+    // TileSize x TileSize セルのタイルに分けて、値が変化するタイルだけを確保する2次元グリッド
+    // タイル内が全て同じ値なら値1つだけを持つため、メモリ量はマップの広さではなく値が変化する範囲で決まる
+    // Grid と異なり余白・線形インデックスは持たない (近傍を index() のずれで参照する探索には使えない)
+    template <typename T>
+    class TiledGrid
+    {
+    public:
+        static constexpr int TileShift = 6;
+        static constexpr int TileSize = 1 << TileShift;
+
+        TiledGrid() = default;
+
+        // w x h の領域を fill で初期化する (タイルは確保しない)
+        void assign(int w, int h, T fill) {
+            m_w = std::max(0, w);
+            m_h = std::max(0, h);
+            m_cols = (m_w + TileSize - 1) >> TileShift;
+            const int rows = (m_h + TileSize - 1) >> TileShift;
+            m_tiles.assign(size_t(m_cols) * size_t(rows), Tile());
+            for (Tile& tile : m_tiles) tile.value = fill;
+        }
+
+        void clear() {
+            m_tiles.clear();
+            m_tiles.shrink_to_fit();
+            m_w = m_h = m_cols = 0;
+        }
+
+        bool empty() const { return m_w == 0 || m_h == 0; }
+        int width() const { return m_w; }
+        int height() const { return m_h; }
+
+        bool contains(int x, int y) const { return x >= 0 && x < m_w && y >= 0 && y < m_h; }
+        bool contains(const QPoint& p) const { return contains(p.x(), p.y()); }
+
+        T at(int x, int y) const {
+            const Tile& tile = tileAt(x, y);
+            return tile.data.empty() ? tile.value : tile.data[size_t(offset(x, y))];
+        }
+
+        void set(int x, int y, T value) {
+            Tile& tile = m_tiles[size_t(tileIndex(x, y))];
+            if (tile.data.empty()) {
+                if (tile.value == value) return;
+                tile.data.assign(size_t(TileSize) * TileSize, tile.value);
+            }
+            tile.data[size_t(offset(x, y))] = value;
+        }
+
+    private:
+        struct Tile {
+            T value = T();       // data が空のときのタイル全体の値
+            std::vector<T> data; // 値が一様でないときだけ TileSize x TileSize を確保する
+        };
+
+        int tileIndex(int x, int y) const { return (y >> TileShift) * m_cols + (x >> TileShift); }
+        const Tile& tileAt(int x, int y) const { return m_tiles[size_t(tileIndex(x, y))]; }
+        static int offset(int x, int y) { return ((y & (TileSize - 1)) << TileShift) | (x & (TileSize - 1)); }
+
+        std::vector<Tile> m_tiles;
+        int m_w = 0;
+        int m_h = 0;
+        int m_cols = 0;
+    };
+
+    // セル値 (0:通行可, 1:障害物)
+    using OccupancyGrid = Grid<uint8_t>;
+    // 格子距離 (セル数)。未到達は DistanceUnreached
+    using DistanceGrid = Grid<uint16_t>;
+    constexpr uint16_t DistanceUnreached = 0xFFFF;
+    // セルへ進入する際に移動コストへ加算する値
+    using CostGrid = Grid<uint32_t>;
+
+}
+
+#endif // GRID_H
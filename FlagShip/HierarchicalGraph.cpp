@@ -0,0 +1,409 @@
+﻿#include "HierarchicalGraph.h"
+#include "Parallel.h"
+#include "RadixHeap.h"
+#include <queue>
+#include <algorithm>
+#include <functional>
+
+namespace Pathfinding {
+
+    namespace {
+        constexpr int StraightCost = 10;
+        constexpr int DiagonalCost = 15;
+
+        // これより長い開口部には両端にも出入口を置く (短いものは1つ)
+        constexpr int MaxSingleEntrance = 6;
+
+        int octile(const QPoint& a, const QPoint& b)
+        {
+            const int dx = std::abs(a.x() - b.x());
+            const int dy = std::abs(a.y() - b.y());
+            return 10 * (dx + dy) + (14 - 2 * 10) * std::min(dx, dy);
+        }
+
+        // rect 内に限定した 8近傍の局所探索 (クラスタ内の Dijkstra / A*)
+        // セルは rect 内のローカル番号で管理し、作業配列は呼び出し間で使い回す
+        class LocalSearch
+        {
+        public:
+            // reverse: 辺を逆向きにたどり、各セルから source へのコストを求める
+            // target を指定した場合は A* で target に到達した時点で打ち切る
+            // settle を指定した場合は、その中の未確定のセルが無くなった時点で打ち切る
+            void run(const OccupancyGrid& grid, const uint32_t* stepCost, const QRect& rect,
+                const QPoint& source, bool reverse, const QPoint* target = nullptr,
+                const std::vector<QPoint>* settle = nullptr)
+            {
+                m_rect = rect;
+                const int w = rect.width();
+                const size_t n = size_t(w) * size_t(rect.height());
+                m_dist.assign(n, -1);
+                m_parent.assign(n, -1);
+                m_closed.assign(n, 0);
+                m_expansions = 0;
+
+                int remaining = -1;
+                if (settle) {
+                    m_settle.assign(n, 0);
+                    remaining = 0;
+                    for (const QPoint& p : *settle) {
+                        uint8_t& mark = m_settle[size_t(local(p))];
+                        if (!mark) ++remaining;
+                        mark = 1;
+                    }
+                }
+
+                m_open.reset(int(n));
+                const int src = local(source);
+                const int dst = target ? local(*target) : -1;
+                m_dist[size_t(src)] = 0;
+                m_open.push(src, target ? uint32_t(octile(source, *target)) : 0);
+
+                const int h = rect.height();
+                const int stride = grid.stride();
+                const uint8_t* occ = grid.data();
+                const int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
+                const int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+
+                while (!m_open.empty()) {
+                    const int li = m_open.pop();
+                    m_closed[size_t(li)] = 1;
+                    ++m_expansions;
+                    if (li == dst) break;
+                    if (remaining > 0 && m_settle[size_t(li)] && --remaining == 0) break;
+
+                    const int lx = li % w;
+                    const int ly = li / w;
+                    const int pg = grid.index(rect.left() + lx, rect.top() + ly);
+                    const int pd = m_dist[size_t(li)];
+                    for (int i = 0; i < 8; ++i) {
+                        const int qx = lx + dx[i];
+                        const int qy = ly + dy[i];
+                        if (unsigned(qx) >= unsigned(w) || unsigned(qy) >= unsigned(h)) continue;
+                        const int qg = pg + dy[i] * stride + dx[i];
+                        if (occ[qg] != 0) continue;
+                        if (i >= 4 && (occ[pg + dx[i]] != 0 || occ[pg + dy[i] * stride] != 0)) continue;
+
+                        // 追加コストは順方向で進入する側のセルに掛かる
+                        int c = (i < 4) ? StraightCost : DiagonalCost;
+                        if (stepCost) c += int(stepCost[reverse ? pg : qg]);
+
+                        const int qi = qy * w + qx;
+                        const int nd = pd + c;
+                        if (m_closed[size_t(qi)] || (m_dist[size_t(qi)] != -1 && nd >= m_dist[size_t(qi)])) continue;
+                        const int hq = target ? octile(QPoint(rect.left() + qx, rect.top() + qy), *target) : 0;
+                        if (m_dist[size_t(qi)] == -1) m_open.push(qi, uint32_t(nd + hq));
+                        else m_open.decrease(qi, uint32_t(nd + hq));
+                        m_dist[size_t(qi)] = nd;
+                        m_parent[size_t(qi)] = li;
+                    }
+                }
+            }
+
+            // source からのコスト (reverse 時は source へのコスト)。到達不可は -1
+            int cost(const QPoint& p) const { return m_dist[size_t(local(p))]; }
+
+            // source から p までのセル列 (順方向の探索結果に対してのみ有効)
+            QList<QPoint> pathTo(const QPoint& p) const
+            {
+                QList<QPoint> path;
+                if (cost(p) < 0) return path;
+                for (int li = local(p); li != -1; li = m_parent[size_t(li)]) {
+                    path.prepend(QPoint(m_rect.left() + li % m_rect.width(), m_rect.top() + li / m_rect.width()));
+                }
+                return path;
+            }
+
+            int expansions() const { return m_expansions; }
+
+        private:
+            int local(const QPoint& p) const { return (p.y() - m_rect.top()) * m_rect.width() + (p.x() - m_rect.left()); }
+
+            QRect m_rect;
+            std::vector<int> m_dist;
+            std::vector<int> m_parent;
+            std::vector<uint8_t> m_closed;
+            std::vector<uint8_t> m_settle;
+            RadixHeap m_open;
+            int m_expansions = 0;
+        };
+    }
+
+    HierarchicalGraph::HierarchicalGraph(int clusterSize)
+        : m_clusterSize(std::max(4, clusterSize))
+    {
+    }
+
+    int HierarchicalGraph::nodeCount() const
+    {
+        int n = 0;
+        for (const Cluster& c : m_clusters) n += int(c.nodes.size());
+        return n;
+    }
+
+    void HierarchicalGraph::build(const OccupancyGrid& grid, const uint32_t* stepCost)
+    {
+        m_w = grid.width();
+        m_h = grid.height();
+        m_cols = (m_w + m_clusterSize - 1) / m_clusterSize;
+        m_rows = (m_h + m_clusterSize - 1) / m_clusterSize;
+        m_clusters.assign(size_t(m_cols) * size_t(m_rows), Cluster());
+        for (int cy = 0; cy < m_rows; ++cy) {
+            for (int cx = 0; cx < m_cols; ++cx) {
+                const QRect r(cx * m_clusterSize, cy * m_clusterSize, m_clusterSize, m_clusterSize);
+                m_clusters[size_t(clusterIndex(cx, cy))].rect = r.intersected(QRect(0, 0, m_w, m_h));
+            }
+        }
+
+        parallelFor(0, int(m_clusters.size()), [&](int c) { buildCluster(grid, stepCost, c); }, 4);
+    }
+
+    void HierarchicalGraph::update(const OccupancyGrid& grid, const uint32_t* stepCost, const QRect& cells)
+    {
+        if (!isBuilt() || !matches(grid)) {
+            build(grid, stepCost);
+            return;
+        }
+
+        // 境界上のセルは隣のクラスタの出入口にも影響するため 1セル広げた範囲のクラスタを作り直す
+        const QRect r = cells.adjusted(-1, -1, 1, 1).intersected(QRect(0, 0, m_w, m_h));
+        if (r.isEmpty()) return;
+        std::vector<int> dirty;
+        for (int cy = r.top() / m_clusterSize; cy <= r.bottom() / m_clusterSize; ++cy) {
+            for (int cx = r.left() / m_clusterSize; cx <= r.right() / m_clusterSize; ++cx) {
+                dirty.push_back(clusterIndex(cx, cy));
+            }
+        }
+        parallelFor(0, int(dirty.size()), [&](int i) { buildCluster(grid, stepCost, dirty[size_t(i)]); });
+    }
+
+    int HierarchicalGraph::localNode(int cluster, int cell) const
+    {
+        const std::vector<int>& nodes = m_clusters[size_t(cluster)].nodes;
+        const auto it = std::find(nodes.begin(), nodes.end(), cell);
+        return it == nodes.end() ? -1 : int(it - nodes.begin());
+    }
+
+    void HierarchicalGraph::scanBorder(const OccupancyGrid& grid, const uint32_t* stepCost, const QRect& self, const QRect& other, std::vector<std::pair<int, int>>& out) const
+    {
+        // self 側の境界線と other 側の境界線が両方通行可能な区間 (開口部) ごとに出入口を置く
+        // 同じ境界を両側のクラスタから走査しても同じ位置になるよう、走査は座標順に行う
+        const bool vertical = other.left() == self.right() + 1 || other.right() == self.left() - 1;
+        const int selfLine = vertical ? (other.left() > self.left() ? self.right() : self.left())
+                                      : (other.top() > self.top() ? self.bottom() : self.top());
+        const int otherLine = vertical ? (other.left() > self.left() ? other.left() : other.right())
+                                       : (other.top() > self.top() ? other.top() : other.bottom());
+        const int begin = vertical ? self.top() : self.left();
+        const int end = vertical ? self.bottom() : self.right();
+
+        auto cellOn = [&](int line, int t) { return vertical ? QPoint(line, t) : QPoint(t, line); };
+        auto open = [&](int t) {
+            return grid.at(cellOn(selfLine, t).x(), cellOn(selfLine, t).y()) == 0
+                && grid.at(cellOn(otherLine, t).x(), cellOn(otherLine, t).y()) == 0;
+        };
+        auto place = [&](int t) { out.push_back({ grid.index(cellOn(selfLine, t)), grid.index(cellOn(otherLine, t)) }); };
+
+        for (int t = begin; t <= end; ++t) {
+            if (!open(t)) continue;
+            int last = t;
+            while (last + 1 <= end && open(last + 1)) ++last;
+            // 開口部の中で追加コストが最も小さいセル (同じなら中央寄り) に出入口を置く
+            // 両端は壁際で追加コストが大きくなりやすいため、長い開口部でも端だけにはしない
+            const int mid = (t + last) / 2;
+            int best = mid;
+            uint64_t bestCost = UINT64_MAX;
+            for (int u = t; u <= last; ++u) {
+                uint64_t c = 0;
+                if (stepCost) c = uint64_t(stepCost[grid.index(cellOn(selfLine, u))]) + stepCost[grid.index(cellOn(otherLine, u))];
+                c = (c << 32) | uint64_t(std::abs(u - mid));
+                if (c < bestCost) {
+                    bestCost = c;
+                    best = u;
+                }
+            }
+            if (last - t + 1 > MaxSingleEntrance) {
+                place(t);
+                if (best != t && best != last) place(best);
+                place(last);
+            }
+            else {
+                place(best);
+            }
+            t = last;
+        }
+    }
+
+    void HierarchicalGraph::buildCluster(const OccupancyGrid& grid, const uint32_t* stepCost, int c)
+    {
+        Cluster& cl = m_clusters[size_t(c)];
+        cl.nodes.clear();
+        cl.links.clear();
+
+        // 4方向の隣接クラスタとの境界から出入口を集める
+        const int cx = c % m_cols;
+        const int cy = c / m_cols;
+        const int ncx[] = { cx - 1, cx + 1, cx, cx };
+        const int ncy[] = { cy, cy, cy - 1, cy + 1 };
+        std::vector<std::pair<int, int>> pairs;
+        for (int k = 0; k < 4; ++k) {
+            if (ncx[k] < 0 || ncx[k] >= m_cols || ncy[k] < 0 || ncy[k] >= m_rows) continue;
+            const int nc = clusterIndex(ncx[k], ncy[k]);
+            pairs.clear();
+            scanBorder(grid, stepCost, cl.rect, m_clusters[size_t(nc)].rect, pairs);
+            for (const auto& p : pairs) {
+                auto it = std::find(cl.nodes.begin(), cl.nodes.end(), p.first);
+                const int from = int(it - cl.nodes.begin());
+                if (it == cl.nodes.end()) cl.nodes.push_back(p.first);
+                const int cost = StraightCost + (stepCost ? int(stepCost[p.second]) : 0);
+                cl.links.push_back({ from, nc, p.second, cost });
+            }
+        }
+
+        // 出入口間のクラスタ内コスト (各出入口から Dijkstra)
+        // 逆向きの経路は同じセル列を通り、追加コストが掛かるのが始点側か終点側かだけが異なるため
+        // i → j (i < j) の探索結果から j → i も求め、探索は後ろの出入口が全て確定した時点で打ち切る
+        const int k = int(cl.nodes.size());
+        cl.dist.assign(size_t(k) * size_t(k), -1);
+        for (int i = 0; i < k; ++i) cl.dist[size_t(i) * k + i] = 0;
+        thread_local LocalSearch search;
+        std::vector<QPoint> rest;
+        for (int i = 0; i + 1 < k; ++i) {
+            rest.clear();
+            for (int j = i + 1; j < k; ++j) rest.push_back(grid.pointAt(cl.nodes[size_t(j)]));
+            search.run(grid, stepCost, cl.rect, grid.pointAt(cl.nodes[size_t(i)]), false, nullptr, &rest);
+            const int pi = stepCost ? int(stepCost[cl.nodes[size_t(i)]]) : 0;
+            for (int j = i + 1; j < k; ++j) {
+                const int d = search.cost(rest[size_t(j - i - 1)]);
+                if (d < 0) continue;
+                const int pj = stepCost ? int(stepCost[cl.nodes[size_t(j)]]) : 0;
+                cl.dist[size_t(i) * k + j] = d;
+                cl.dist[size_t(j) * k + i] = d - pj + pi;
+            }
+        }
+    }
+
+    QList<QPoint> HierarchicalGraph::findPath(const OccupancyGrid& grid, const uint32_t* stepCost,
+        const QPoint& start, const QPoint& goal, int* expansions) const
+    {
+        if (!isBuilt() || !matches(grid) || !grid.contains(start) || !grid.contains(goal)) return {};
+
+        const int sc = clusterAt(start);
+        const int gc = clusterAt(goal);
+        const Cluster& startCluster = m_clusters[size_t(sc)];
+        const Cluster& goalCluster = m_clusters[size_t(gc)];
+        int expanded = 0;
+
+        // 始点・終点を所属クラスタの出入口へ一時的に接続する
+        LocalSearch fromStart;
+        LocalSearch toGoal;
+        fromStart.run(grid, stepCost, startCluster.rect, start, false);
+        toGoal.run(grid, stepCost, goalCluster.rect, goal, true);
+        expanded += fromStart.expansions() + toGoal.expansions();
+
+        // 抽象グラフ上の A* (ノード番号はクラスタ順の通し番号、末尾が終点)
+        std::vector<int> offset(m_clusters.size() + 1, 0);
+        for (size_t c = 0; c < m_clusters.size(); ++c) {
+            offset[c + 1] = offset[c] + int(m_clusters[c].nodes.size());
+        }
+        const int goalNode = offset.back();
+        std::vector<int> gCost(size_t(goalNode) + 1, -1);
+        std::vector<int> parent(size_t(goalNode) + 1, -1);
+        std::vector<int> nodeCluster(size_t(goalNode) + 1, gc);
+        std::vector<uint8_t> closed(size_t(goalNode) + 1, 0);
+        for (size_t c = 0; c < m_clusters.size(); ++c) {
+            std::fill(nodeCluster.begin() + offset[c], nodeCluster.begin() + offset[c + 1], int(c));
+        }
+        auto cellOf = [&](int id) {
+            if (id == goalNode) return goal;
+            const int c = nodeCluster[size_t(id)];
+            return grid.pointAt(m_clusters[size_t(c)].nodes[size_t(id - offset[size_t(c)])]);
+        };
+
+        typedef std::pair<int, int> Entry; // (f, ノード番号)
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+        auto relax = [&](int id, int g, int from) {
+            if (closed[size_t(id)] || (gCost[size_t(id)] != -1 && g >= gCost[size_t(id)])) return;
+            gCost[size_t(id)] = g;
+            parent[size_t(id)] = from;
+            open.push({ g + octile(cellOf(id), goal), id });
+        };
+
+        for (size_t i = 0; i < startCluster.nodes.size(); ++i) {
+            const int c = fromStart.cost(grid.pointAt(startCluster.nodes[i]));
+            if (c >= 0) relax(offset[size_t(sc)] + int(i), c, -1);
+        }
+        // 同じクラスタ内なら直接の経路も候補にする
+        if (sc == gc && fromStart.cost(goal) >= 0) relax(goalNode, fromStart.cost(goal), -1);
+
+        // 隣接クラスタ同士なら、両クラスタを合わせた範囲の局所 A* も候補にする
+        // (近距離では出入口を経由する遠回りの比率が大きくなるため)
+        LocalSearch nearby;
+        int nearbyCost = -1;
+        if (sc != gc && std::abs(sc % m_cols - gc % m_cols) <= 1 && std::abs(sc / m_cols - gc / m_cols) <= 1) {
+            nearby.run(grid, stepCost, startCluster.rect.united(goalCluster.rect), start, false, &goal);
+            expanded += nearby.expansions();
+            nearbyCost = nearby.cost(goal);
+        }
+
+        bool found = false;
+        while (!open.empty()) {
+            const int id = open.top().second;
+            open.pop();
+            if (closed[size_t(id)]) continue;
+            closed[size_t(id)] = 1;
+            ++expanded;
+            if (id == goalNode) {
+                found = true;
+                break;
+            }
+
+            const int c = nodeCluster[size_t(id)];
+            const int i = id - offset[size_t(c)];
+            const Cluster& cl = m_clusters[size_t(c)];
+            const int k = int(cl.nodes.size());
+            const int g = gCost[size_t(id)];
+
+            for (int j = 0; j < k; ++j) {
+                const int d = cl.dist[size_t(i) * k + j];
+                if (j != i && d >= 0) relax(offset[size_t(c)] + j, g + d, id);
+            }
+            for (const Link& link : cl.links) {
+                if (link.from != i) continue;
+                const int to = localNode(link.toCluster, link.toCell);
+                if (to >= 0) relax(offset[size_t(link.toCluster)] + to, g + link.cost, id);
+            }
+            if (c == gc) {
+                const int d = toGoal.cost(cellOf(id));
+                if (d >= 0) relax(goalNode, g + d, id);
+            }
+        }
+
+        if (expansions) *expansions = expanded;
+        if (nearbyCost >= 0 && (!found || nearbyCost <= gCost[size_t(goalNode)])) return nearby.pathTo(goal);
+        if (!found) return {};
+
+        // 出入口の列を詳細化する
+        // 隣接クラスタへの1歩はそのまま、クラスタ内の区間は局所 A* で埋める
+        std::vector<int> chain;
+        for (int id = goalNode; id != -1; id = parent[size_t(id)]) chain.push_back(id);
+        std::reverse(chain.begin(), chain.end());
+
+        QList<QPoint> path = fromStart.pathTo(cellOf(chain.front()));
+        LocalSearch segment;
+        for (size_t n = 1; n < chain.size(); ++n) {
+            const QPoint from = cellOf(chain[n - 1]);
+            const QPoint to = cellOf(chain[n]);
+            const int fc = nodeCluster[size_t(chain[n - 1])];
+            const int tc = chain[n] == goalNode ? gc : nodeCluster[size_t(chain[n])];
+            if (fc != tc) {
+                path.append(to);
+                continue;
+            }
+            segment.run(grid, stepCost, m_clusters[size_t(fc)].rect, from, false, &to);
+            if (expansions) *expansions += segment.expansions();
+            const QList<QPoint> part = segment.pathTo(to);
+            for (int p = 1; p < part.size(); ++p) path.append(part[p]);
+        }
+        return path;
+    }
+
+}
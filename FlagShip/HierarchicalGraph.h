@@ -0,0 +1,74 @@
+﻿#ifndef HIERARCHICALGRAPH_H
+#define HIERARCHICALGRAPH_H
+
+#include <QPoint>
+#include <QRect>
+#include <QList>
+#include <vector>
+#include <cstdint>
+#include "Grid.h"
+
+namespace Pathfinding {
+
+    // HPA* (Hierarchical Pathfinding A*) の抽象グラフ
+    // C-Space を固定サイズのクラスタに分割し、隣接クラスタ間の出入口 (エントランス) をノード、
+    // クラスタ内の出入口間の最短コストと隣接クラスタへの1歩を辺とする
+    // 探索は抽象グラフ上で行い、得られた出入口の列をクラスタ内の局所探索で詳細化する
+    // (経路はクラスタ内に制限した区間の連結になるため、最適解より僅かに長くなることがある)
+    //
+    // 辺のコストは Pathfinder と同じ (直進 10・斜め 15 + 進入セルの追加コスト stepCost)
+    // stepCost は grid と同じ寸法・余白のレイヤー (nullptr なら一様コスト)
+    class HierarchicalGraph
+    {
+    public:
+        explicit HierarchicalGraph(int clusterSize = 32);
+
+        // 全クラスタを構築する
+        void build(const OccupancyGrid& grid, const uint32_t* stepCost);
+
+        // cells に掛かるクラスタだけを再構築する (grid・stepCost は更新済みであること)
+        void update(const OccupancyGrid& grid, const uint32_t* stepCost, const QRect& cells);
+
+        // start, goal は通行可能なセル。見つからなければ空のリスト
+        // expansions には抽象グラフと詳細化で展開したノード数の合計を返す
+        QList<QPoint> findPath(const OccupancyGrid& grid, const uint32_t* stepCost,
+            const QPoint& start, const QPoint& goal, int* expansions = nullptr) const;
+
+        bool isBuilt() const { return !m_clusters.empty(); }
+        bool matches(const OccupancyGrid& grid) const { return m_w == grid.width() && m_h == grid.height(); }
+        int clusterSize() const { return m_clusterSize; }
+        int nodeCount() const;
+
+    private:
+        // 隣接クラスタへの1歩 (from: クラスタ内ノード番号)
+        struct Link {
+            int from;
+            int toCluster;
+            int toCell;
+            int cost;
+        };
+
+        struct Cluster {
+            QRect rect;
+            std::vector<int> nodes; // 出入口セルの線形インデックス
+            std::vector<int> dist;  // nodes[i] → nodes[j] のコスト (nodes.size() 四方、到達不可は -1)
+            std::vector<Link> links;
+        };
+
+        int clusterIndex(int cx, int cy) const { return cy * m_cols + cx; }
+        int clusterAt(const QPoint& p) const { return clusterIndex(p.x() / m_clusterSize, p.y() / m_clusterSize); }
+        int localNode(int cluster, int cell) const;
+        void buildCluster(const OccupancyGrid& grid, const uint32_t* stepCost, int c);
+        void scanBorder(const OccupancyGrid& grid, const uint32_t* stepCost, const QRect& self, const QRect& other, std::vector<std::pair<int, int>>& out) const;
+
+        int m_clusterSize;
+        int m_w = 0;
+        int m_h = 0;
+        int m_cols = 0;
+        int m_rows = 0;
+        std::vector<Cluster> m_clusters;
+    };
+
+}
+
+#endif // HIERARCHICALGRAPH_H
@@ -1,5 +1,6 @@
 ﻿#include "mapview.h"
 #include "Pathfinder.h"
+#include "Parallel.h"
 #include "commands.h"
 #include <QDebug>
 #include <cmath>
@@ -8,6 +9,10 @@
 #include <QUndoStack>
 #include <QLineF>
 #include <QThread>
+#include <list>
+#include <map>
+#include <tuple>
+#include <algorithm>
 
 namespace {
     const QList<QColor> WP_COLORS = {
@@ -18,13 +23,76 @@ namespace {
     };
 }
 
-PathfindingWorker::PathfindingWorker(const InputData& data, QObject* parent)
-    : QObject(parent), m_data(data)
+// 区間の探索結果を再利用する条件 (端点のセル・モード・探索条件のキー・探索モード)
+struct SegmentKey {
+    QPoint start;
+    QPoint goal;
+    int mode;
+    quint64 searchKey;
+    int pfMode;
+
+    bool operator<(const SegmentKey& o) const {
+        return std::make_tuple(start.x(), start.y(), goal.x(), goal.y(), mode, searchKey, pfMode)
+            < std::make_tuple(o.start.x(), o.start.y(), o.goal.x(), o.goal.y(), o.mode, o.searchKey, o.pfMode);
+    }
+};
+
+struct PathfindingSession {
+    Pathfinding::Pathfinder finders[2]; // 0: Safe, 1: Aggressive
+
+    // 区間の探索結果 (文字列引き後のセル列) のキャッシュ
+    // 1つのウェイポイントを動かした場合は、それに接する2区間だけを探索し直す
+    static constexpr size_t SegmentCacheCapacity = 256;
+    // 使った順のリスト (先頭が最新) とキーからリスト要素への索引。取り出し・追加・追い出しは索引の検索だけで済む
+    using SegmentList = std::list<std::pair<SegmentKey, QList<QPoint>>>;
+    SegmentList segmentCache;
+    std::map<SegmentKey, SegmentList::iterator> segmentIndex;
+
+    const QList<QPoint>* findSegment(const SegmentKey& key) {
+        auto it = segmentIndex.find(key);
+        if (it == segmentIndex.end()) return nullptr;
+        segmentCache.splice(segmentCache.begin(), segmentCache, it->second);
+        return &it->second->second;
+    }
+
+    void storeSegment(const SegmentKey& key, const QList<QPoint>& path) {
+        auto it = segmentIndex.find(key);
+        if (it != segmentIndex.end()) {
+            it->second->second = path;
+            segmentCache.splice(segmentCache.begin(), segmentCache, it->second);
+            return;
+        }
+        // 容量を超えたら最も長く使われていないもの (リストの末尾) を捨てる
+        if (segmentCache.size() >= SegmentCacheCapacity) {
+            segmentIndex.erase(segmentCache.back().first);
+            segmentCache.pop_back();
+        }
+        segmentCache.emplace_front(key, path);
+        segmentIndex.emplace(key, segmentCache.begin());
+    }
+};
+
+PathfindingWorker::PathfindingWorker(QObject* parent)
+    : QObject(parent), m_session(std::make_unique<PathfindingSession>())
 {
 }
 
-void PathfindingWorker::process() {
-    Pathfinding::Pathfinder finder;
+PathfindingWorker::~PathfindingWorker() = default;
+
+void PathfindingWorker::process(quint64 job, const InputData& data) {
+    m_job = job;
+    m_data = data;
+    PathfindingSession* session = m_session.get();
+
+    // キューで待っている間に中止・置き換えられた探索は始めない
+    const Pathfinding::CancelToken cancel = m_data.cancel;
+    auto isCancelled = [&]() { return cancel && cancel->load(); };
+    if (isCancelled()) {
+        emit finished(m_job, {}, true, -1, "Search cancelled.");
+        return;
+    }
+    emit started(m_job, m_data.submitted.nsecsElapsed());
+
     Pathfinding::PathfinderConfig cfg;
     cfg.mapW = m_data.w;
     cfg.mapH = m_data.h;
@@ -37,8 +105,19 @@ void PathfindingWorker::process() {
     cfg.safeThresh = m_data.safeThresh;
     cfg.edgeThresh = m_data.edgeThresh;
     cfg.useWpField = (m_data.pfMode == 2);
-
-    finder.setConfig(cfg);
+    cfg.orientedFootprint = m_data.orientedFootprint;
+    cfg.robotAngle = m_data.robotAngle;
+    if (m_data.anyAngle) cfg.algorithm = Pathfinding::SearchAlgorithm::AnyAngle;
+
+    // モード別の Pathfinder に今回の設定を反映する
+    // 障害物は今回の設定のレイヤーに前回の探索との差分だけを更新し、レイヤーと区間ごとの探索状態を引き継ぐ
+    auto finderFor = [&](int modeVal) -> Pathfinding::Pathfinder& {
+        Pathfinding::Pathfinder& f = session->finders[modeVal];
+        cfg.mode = modeVal;
+        f.updateConfig(cfg);
+        return f;
+    };
+    Pathfinding::Pathfinder& finder = finderFor(0);
 
     QList<QList<QPointF>> segs;
     bool fail = false;
@@ -57,7 +136,7 @@ void PathfindingWorker::process() {
     QList<QPointF> pts;
     if (m_data.isLoop) {
         if (m_data.wps.count() < 2) {
-            emit finished({}, true, -1, "Loop requires at least 2 waypoints.");
+            emit finished(m_job, {}, true, -1, "Loop requires at least 2 waypoints.");
             return;
         }
         pts = m_data.wps;
@@ -70,26 +149,106 @@ void PathfindingWorker::process() {
     }
 
     if (pts.size() < 2) {
-        emit finished({}, true, -1, "Not enough points (Start/Goal or Waypoints missing).");
+        emit finished(m_job, {}, true, -1, "Not enough points (Start/Goal or Waypoints missing).");
         return;
     }
 
     int totalSegments = pts.size() - 1;
 
-    if (!m_data.isLoop && m_data.pfMode == 0) {
-        cfg.mode = 0;
-        finder.setConfig(cfg);
+    // 区間 i のモード (ループでは最後のウェイポイントから始点へ戻る区間も最後のモードを使う)
+    auto segmentMode = [&](int i) {
+        const int midx = m_data.isLoop ? qMin(i, int(m_data.wps.size()) - 1) : i;
+        return midx < m_data.wpModes.size() ? m_data.wpModes[midx] : 0;
+    };
+
+    // 区間ごとの折れ点の列をつないで平滑化し、区間ごとに切り分ける
+    auto smoothSegments = [&](const QList<QList<QPointF>>& ctrlSegs) {
+        QList<QList<QPointF>> out;
+        QList<QPointF> allCtrl;
+        for (const auto& world : ctrlSegs) {
+            if (allCtrl.isEmpty()) allCtrl.append(world);
+            else allCtrl.append(world.mid(1));
+        }
+
+        if (allCtrl.size() < 2) {
+            out = ctrlSegs;
+        }
+        else {
+            auto smooth = finder.smoothPathCatmullRom(allCtrl, m_data.tension, 30);
+            int startIdx = 0;
+            for (int i = 0; i < ctrlSegs.size(); ++i) {
+                int pairs = qMax(0, (int)ctrlSegs[i].size() - 1);
+                int ptsCount = pairs * 30;
+                int take = ptsCount + 1;
+                if (i == ctrlSegs.size() - 1) out.append(smooth.mid(startIdx));
+                else out.append(smooth.mid(startIdx, take));
+                startIdx += ptsCount;
+            }
+        }
+
+        if (m_data.isLoop) {
+            QList<QList<QPointF>> resampled;
+            double ds = qMax(1.0, (double)m_data.res);
+            for (const auto& s : out) {
+                resampled.append(finder.resampleByArcLength(s, ds));
+            }
+            out = resampled;
+        }
+        return out;
+    };
 
+    if (m_data.visibilityGraph) {
+        // 矩形障害物の可視グラフで区間ごとの厳密な最短経路 (折れ点の列) を求める
+        // グラフはモード別の Pathfinder が障害物・膨張量が変わるまで保持するため、ここでは端点をつなぐだけになる
+        const bool direct = !m_data.isLoop && m_data.pfMode == 0;
+        const QList<QPointF> ends = direct ? QList<QPointF>{ m_data.start, m_data.goal } : pts;
+        const int count = ends.size() - 1;
+        QList<QList<QPointF>> ctrlSegs;
+        Pathfinding::Pathfinder* modeFinders[2] = { &finder, nullptr };
+        for (int i = 0; i < count; ++i) {
+            if (isCancelled()) {
+                emit finished(m_job, {}, true, -1, "Search cancelled.");
+                return;
+            }
+            const int modeVal = direct ? 0 : segmentMode(i);
+            if (!modeFinders[modeVal]) modeFinders[modeVal] = &finderFor(modeVal);
+            auto path = modeFinders[modeVal]->findVisibilityPath(ends[i], ends[i + 1]);
+            if (path.isEmpty()) {
+                failMsg = direct ? QString("Path failed (Direct).")
+                    : m_data.isLoop ? QString("Loop path failed at WP %1 -> %2").arg(i).arg((i + 1) % m_data.wps.count())
+                    : QString("Path failed at segment %1 -> %2").arg(i).arg(i + 1);
+                emit finished(m_job, {}, true, direct ? 0 : i, failMsg);
+                return;
+            }
+            ctrlSegs.append(path);
+            emit progressChanged(m_job, float(i + 1) / count);
+        }
+        segs = smoothSegments(ctrlSegs);
+    }
+    else if (!m_data.isLoop && m_data.pfMode == 0) {
+        // 全域を横断する1区間。探索エンジンは設定のまま (Auto なら追加コストがある場合に両側から並列に探索する)
         QPoint sc(m_data.start.x() / m_data.res, m_data.start.y() / m_data.res);
         QPoint gc(m_data.goal.x() / m_data.res, m_data.goal.y() / m_data.res);
 
-        auto path = finder.findPath(sc, gc, [&](float p) { emit progressChanged(p); });
+        const SegmentKey key{ sc, gc, 0, finder.searchKey(), m_data.pfMode };
+        QList<QPoint> pulled;
+        if (const QList<QPoint>* cached = session->findSegment(key)) {
+            pulled = *cached;
+        }
+        else {
+            auto path = finder.findPath(sc, gc, [&](float p) { emit progressChanged(m_job, p); }, cancel);
 
-        if (path.isEmpty()) {
-            emit finished({}, true, 0, "Path failed (Direct).");
-            return;
+            if (isCancelled()) {
+                emit finished(m_job, {}, true, -1, "Search cancelled.");
+                return;
+            }
+            if (path.isEmpty()) {
+                emit finished(m_job, {}, true, 0, "Path failed (Direct).");
+                return;
+            }
+            pulled = finder.smoothPathStringPulling(path);
+            session->storeSegment(key, pulled);
         }
-        auto pulled = finder.smoothPathStringPulling(path);
         auto world = gridToWorld(pulled);
         if (world.size() >= 2) {
             segs.append(finder.smoothPathCatmullRom(world, m_data.tension, 30));
@@ -101,43 +260,125 @@ void PathfindingWorker::process() {
     else {
         // Multi-segment
         QList<QList<QPointF>> ctrlSegs;
-        QList<QPointF> allCtrl;
 
+        // 区間ごとの端点とモード
+        QList<Pathfinding::SegmentQuery> queries;
+        QList<int> segModes;
         for (int i = 0; i < pts.size() - 1; ++i) {
-            emit progressChanged((float)i / (float)totalSegments);
-
             QPoint s(pts[i].x() / m_data.res, pts[i].y() / m_data.res);
             QPoint g(pts[i + 1].x() / m_data.res, pts[i + 1].y() / m_data.res);
 
-            int midx = i;
-            if (m_data.isLoop) midx = (i < m_data.wps.size()) ? i : m_data.wps.size() - 1;
-            else midx = i;
+            queries.append({ i, s, g });
+            segModes.append(segmentMode(i));
+        }
 
-            int modeVal = 0;
-            if (midx < m_data.wpModes.size()) modeVal = m_data.wpModes[midx];
+        // 端点・モード・探索条件が前回までと同じ区間はキャッシュの結果を使い、残りだけを探索する
+        QList<SegmentKey> keys;
+        QList<QList<QPoint>> pulledPaths;
+        QList<bool> searched;
+        quint64 modeKeys[2] = {};
+        bool modeUsed[2] = {};
+        int cachedSegments = 0;
+        for (int i = 0; i < totalSegments; ++i) {
+            const int modeVal = segModes[i];
+            if (!modeUsed[modeVal]) {
+                modeKeys[modeVal] = finderFor(modeVal).searchKey();
+                modeUsed[modeVal] = true;
+            }
+            keys.append({ queries[i].start, queries[i].goal, modeVal, modeKeys[modeVal], m_data.pfMode });
+            const QList<QPoint>* cached = session->findSegment(keys[i]);
+            pulledPaths.append(cached ? *cached : QList<QPoint>());
+            searched.append(!cached);
+            if (cached) ++cachedSegments;
+        }
 
-            cfg.mode = modeVal;
-            finder.setConfig(cfg);
+        // 探索した区間は、探索に使ったレイヤーが残っているうちに平滑化してキャッシュに入れる
+        // (向きを選び直す探索では、区間ごとに別の向きのレイヤーになるため)
+        auto storeSearched = [&](int i, const QList<QPoint>& path) {
+            if (path.isEmpty()) return;
+            pulledPaths[i] = session->finders[segModes[i]].smoothPathStringPulling(path);
+            session->storeSegment(keys[i], pulledPaths[i]);
+        };
 
-            auto path = finder.findPath(s, g, [&](float p) {
-                // Local segment progress mixed with global
-                float base = (float)i / totalSegments;
-                float segPart = (1.0f / totalSegments) * p;
-                emit progressChanged(base + segPart);
+        if (m_data.anyAngle) {
+            // 任意角度の経路は差分再計画に対応していないため毎回探索する
+            // 区間は互いに独立なので、モードごとに共有のレイヤーを用意して並列に探索する
+            std::atomic<int> doneSegments(cachedSegments);
+            for (int modeVal = 0; modeVal < 2 && !isCancelled(); ++modeVal) {
+                QList<int> group;
+                for (int i = 0; i < totalSegments; ++i) {
+                    if (segModes[i] == modeVal && searched[i]) group.append(i);
+                }
+                if (group.isEmpty()) continue;
+
+                Pathfinding::Pathfinder& groupFinder = finderFor(modeVal);
+                groupFinder.prepareSharedSearch();
+                std::vector<QList<QPoint>> found(size_t(group.size()));
+                Pathfinding::parallelFor(0, int(group.size()), [&](int k) {
+                    const Pathfinding::SegmentQuery& q = queries[group[k]];
+                    found[size_t(k)] = groupFinder.findPathShared(q.start, q.goal, nullptr, cancel);
+                    emit progressChanged(m_job, float(doneSegments.fetch_add(1) + 1) / totalSegments);
                 });
+                for (int k = 0; k < group.size(); ++k) storeSearched(group[k], found[size_t(k)]);
+
+                // 向きを考慮した C-Space では、robotAngle の向きで通れない区間だけ向きを選び直して探索する
+                if (m_data.orientedFootprint) {
+                    for (int k = 0; k < group.size() && !isCancelled(); ++k) {
+                        if (!found[size_t(k)].isEmpty()) continue;
+                        const Pathfinding::SegmentQuery& q = queries[group[k]];
+                        storeSearched(group[k], groupFinder.findPath(q.start, q.goal, nullptr, cancel));
+                    }
+                }
+            }
+        }
+        else {
+            // モードごとに区間をまとめて並列に探索する。初めての区間は指定の探索エンジンで求め、
+            // 障害物を動かした後は前回と同じ区間の探索状態のうち変化した範囲の影響だけを修正して再計画する
+            int doneSegments = cachedSegments;
+            for (int modeVal = 0; modeVal < 2; ++modeVal) {
+                QList<Pathfinding::SegmentQuery> group;
+                for (int i = 0; i < totalSegments; ++i) {
+                    if (segModes[i] == modeVal && searched[i]) group.append(queries[i]);
+                }
+                if (group.isEmpty()) continue;
+
+                const int base = doneSegments;
+                Pathfinding::Pathfinder& groupFinder = finderFor(modeVal);
+                auto found = groupFinder.findPathsIncremental(group, [&](float p) {
+                    emit progressChanged(m_job, (base + p * group.size()) / totalSegments);
+                    }, cancel);
+                for (int k = 0; k < group.size(); ++k) storeSearched(group[k].segment, found[k]);
+
+                // 向きを考慮した C-Space では、robotAngle の向きで通れない区間だけ向きを選び直して探索する
+                if (m_data.orientedFootprint) {
+                    for (int k = 0; k < group.size() && !isCancelled(); ++k) {
+                        if (!found[k].isEmpty()) continue;
+                        storeSearched(group[k].segment, groupFinder.findPath(group[k].start, group[k].goal, nullptr, cancel));
+                    }
+                }
+                doneSegments += group.size();
+                if (isCancelled()) break;
+            }
+        }
 
-            if (path.isEmpty()) {
+        if (isCancelled()) {
+            emit finished(m_job, {}, true, -1, "Search cancelled.");
+            return;
+        }
+
+        // 区間の順に結果を組み立てる
+        for (int i = 0; i < totalSegments; ++i) {
+            if (pulledPaths[i].isEmpty()) {
                 fail = true;
                 failIdx = i;
                 failMsg = m_data.isLoop
                     ? QString("Loop path failed at WP %1 -> %2").arg(i).arg((i + 1) % m_data.wps.count())
                     : QString("Path failed at segment %1 -> %2").arg(i).arg(i + 1);
-                emit finished({}, true, failIdx, failMsg);
+                emit finished(m_job, {}, true, failIdx, failMsg);
                 return;
             }
 
-            auto pulled = finder.smoothPathStringPulling(path);
-            auto world = gridToWorld(pulled);
+            auto world = gridToWorld(pulledPaths[i]);
 
             if (world.size() < 2) {
                 world.clear();
@@ -146,38 +387,45 @@ void PathfindingWorker::process() {
             }
 
             ctrlSegs.append(world);
-            if (allCtrl.isEmpty()) allCtrl.append(world);
-            else allCtrl.append(world.mid(1));
         }
 
-        if (allCtrl.size() < 2) {
-            segs = ctrlSegs;
-        }
-        else {
-            auto smooth = finder.smoothPathCatmullRom(allCtrl, m_data.tension, 30);
-            int startIdx = 0;
-            for (int i = 0; i < ctrlSegs.size(); ++i) {
-                int pairs = qMax(0, (int)ctrlSegs[i].size() - 1);
-                int ptsCount = pairs * 30;
-                int take = ptsCount + 1;
-                if (i == ctrlSegs.size() - 1) segs.append(smooth.mid(startIdx));
-                else segs.append(smooth.mid(startIdx, take));
-                startIdx += ptsCount;
-            }
-        }
+        // 区間が減った場合は余った探索状態を捨てる
+        for (auto& f : session->finders) f.discardIncremental(totalSegments);
 
-        if (m_data.isLoop) {
-            QList<QList<QPointF>> resampled;
-            double ds = qMax(1.0, (double)m_data.res);
-            for (const auto& s : segs) {
-                resampled.append(finder.resampleByArcLength(s, ds));
-            }
-            segs = resampled;
-        }
+        segs = smoothSegments(ctrlSegs);
     }
 
-    emit progressChanged(1.0f);
-    emit finished(segs, false, -1, "");
+    emit progressChanged(m_job, 1.0f);
+    emit finished(m_job, segs, false, -1, "");
+}
+
+// -------------------------------------------------------------------------
+// PlannerService Implementation
+// -------------------------------------------------------------------------
+
+PlannerService::PlannerService(QObject* parent)
+    : QObject(parent), m_worker(new PathfindingWorker)
+{
+    m_worker->moveToThread(&m_thread);
+    connect(&m_thread, &QThread::finished, m_worker, &QObject::deleteLater);
+    connect(m_worker, &PathfindingWorker::started, this, &PlannerService::started);
+    connect(m_worker, &PathfindingWorker::progressChanged, this, &PlannerService::progressChanged);
+    connect(m_worker, &PathfindingWorker::finished, this, &PlannerService::finished);
+    m_thread.start();
+}
+
+PlannerService::~PlannerService() {
+    // 実行中のジョブは呼び出し側で中止しておくこと (キューに残ったジョブは実行しない)
+    m_thread.quit();
+    m_thread.wait();
+}
+
+quint64 PlannerService::submit(PathfindingWorker::InputData data) {
+    const quint64 job = ++m_lastJob;
+    data.submitted.start();
+    PathfindingWorker* worker = m_worker;
+    QMetaObject::invokeMethod(worker, [worker, job, data]() { worker->process(job, data); }, Qt::QueuedConnection);
+    return job;
 }
 
 // -------------------------------------------------------------------------
@@ -187,11 +435,31 @@ void PathfindingWorker::process() {
 MapView::MapView(QQuickItem* parent) : QQuickPaintedItem(parent)
 {
     m_finder = std::make_unique<Pathfinding::Pathfinder>();
+    m_planner = new PlannerService(this);
+    connect(m_planner, &PlannerService::started, this, [this](quint64 job, qint64 latencyNs) {
+        if (job != m_jobId) return;
+        m_plannerLatencyNs = latencyNs;
+        emit plannerLatencyChanged();
+        });
+    connect(m_planner, &PlannerService::progressChanged, this, [this](quint64 job, float p) {
+        if (job == m_jobId && !m_liveJob) onPathfindingProgress(p);
+        });
+    connect(m_planner, &PlannerService::finished, this, [this](quint64 job, const QList<QList<QPointF>>& segments, bool failed, int failIdx, const QString& msg) {
+        if (job != m_jobId) return;
+        if (m_liveJob) onLiveReplanFinished(segments, failed, failIdx);
+        else onPathfindingFinished(segments, failed, failIdx, msg);
+        });
+
+    m_liveTimer = new QTimer(this);
+    m_liveTimer->setSingleShot(true);
+    m_liveTimer->setInterval(LiveReplanDebounceMs);
+    connect(m_liveTimer, &QTimer::timeout, this, &MapView::runLiveReplan);
     m_undo = new QUndoStack(this);
     QTimer::singleShot(0, this, &MapView::resetView);
 }
 
 MapView::~MapView() {
+    if (m_cancel) m_cancel->store(true);
 }
 
 static QRectF getMapRect(int w, int h, int res) {
@@ -294,9 +562,10 @@ void MapView::paint(QPainter* p)
         p->setBrush(QColor(0, 100, 255, 40));
         const auto& grid = m_finder->getGrid();
         if (!grid.empty()) {
-            for (size_t y = 0; y < grid.size(); ++y) {
-                for (size_t x = 0; x < grid[0].size(); ++x) {
-                    if (grid[y][x] == 1) {
+            for (int y = 0; y < grid.height(); ++y) {
+                const uint8_t* row = &grid.at(0, y);
+                for (int x = 0; x < grid.width(); ++x) {
+                    if (row[x] == 1) {
                         p->drawRect(QRectF(x * m_res, y * m_res, m_res, m_res));
                     }
                 }
@@ -878,6 +1147,12 @@ void MapView::setRobotAngle(qreal a) {
     if (m_robotAng != a) {
         m_robotAng = a;
         emit robotAngleChanged();
+        // 向きを考慮した C-Space では向きで通れる範囲が変わるため、安全領域の表示と経路を作り直す
+        if (m_orientedFootprint) {
+            regeneratePathfinderGrid();
+            if (m_liveReplan) requestLiveReplan();
+            else m_segs.clear();
+        }
         update();
     }
 }
@@ -973,6 +1248,54 @@ void MapView::setShowSafetyZone(bool s) {
     }
 }
 
+bool MapView::liveReplan() const { return m_liveReplan; }
+void MapView::setLiveReplan(bool live) {
+    if (m_liveReplan != live) {
+        m_liveReplan = live;
+        if (!live) stopLiveReplan();
+        emit liveReplanChanged();
+    }
+}
+
+bool MapView::supersedeSearch() const { return m_supersede; }
+void MapView::setSupersedeSearch(bool supersede) {
+    if (m_supersede != supersede) {
+        m_supersede = supersede;
+        emit supersedeSearchChanged();
+    }
+}
+
+bool MapView::anyAnglePath() const { return m_anyAngle; }
+void MapView::setAnyAnglePath(bool anyAngle) {
+    if (m_anyAngle != anyAngle) {
+        m_anyAngle = anyAngle;
+        emit anyAnglePathChanged();
+        m_segs.clear();
+        update();
+    }
+}
+
+bool MapView::orientedFootprint() const { return m_orientedFootprint; }
+void MapView::setOrientedFootprint(bool oriented) {
+    if (m_orientedFootprint != oriented) {
+        m_orientedFootprint = oriented;
+        emit orientedFootprintChanged();
+        m_segs.clear();
+        regeneratePathfinderGrid();
+        update();
+    }
+}
+
+bool MapView::visibilityGraph() const { return m_visibilityGraph; }
+void MapView::setVisibilityGraph(bool visibility) {
+    if (m_visibilityGraph != visibility) {
+        m_visibilityGraph = visibility;
+        emit visibilityGraphChanged();
+        m_segs.clear();
+        update();
+    }
+}
+
 bool MapView::loopPath() const { return m_isLoop; }
 void MapView::setLoopPath(bool loop) {
     if (m_isLoop == loop) return;
@@ -1066,30 +1389,13 @@ void MapView::handleLeftClickInLoopStartPlacementMode(const QPointF&) {
     update();
 }
 
-void MapView::findPath()
+bool MapView::hasPathEndpoints() const
 {
-    if (m_isFinding) return;
-
-    m_pfFail = false;
-    m_failSegIdx = -1;
-    m_segs.clear();
-    m_progress = 0.0f;
-    emit searchProgressChanged();
-    update();
-
-    if (m_isLoop) {
-        if (m_wps.count() < 2) {
-            emit pathfindingFailed("Loop requires at least 2 waypoints.");
-            return;
-        }
-    }
-    else {
-        if (!m_hasStart || !m_hasGoal) {
-            emit pathfindingFailed("Start or Goal not set.");
-            return;
-        }
-    }
+    return m_isLoop ? m_wps.count() >= 2 : (m_hasStart && m_hasGoal);
+}
 
+PathfindingWorker::InputData MapView::pathfindingInput() const
+{
     PathfindingWorker::InputData data;
     data.w = m_mapW;
     data.h = m_mapH;
@@ -1107,6 +1413,10 @@ void MapView::findPath()
     data.start = m_start;
     data.goal = m_goal;
     data.isLoop = m_isLoop;
+    data.anyAngle = m_anyAngle;
+    data.orientedFootprint = m_orientedFootprint;
+    data.visibilityGraph = m_visibilityGraph;
+    data.robotAngle = float(m_robotAng);
 
     if (m_pfMode == PathfindingMode::Direct) data.pfMode = 0;
     else if (m_pfMode == PathfindingMode::WaypointStrict) data.pfMode = 1;
@@ -1114,22 +1424,106 @@ void MapView::findPath()
 
     data.tension = m_tension;
     data.iter = m_iter;
+    return data;
+}
+
+void MapView::findPath()
+{
+    if (m_isFinding) {
+        if (!m_supersede) return;
+        cancelFindPath();
+    }
+    stopLiveReplan();
+
+    m_pfFail = false;
+    m_failSegIdx = -1;
+    m_segs.clear();
+    m_progress = 0.0f;
+    emit searchProgressChanged();
+    update();
 
-    QThread* thread = new QThread;
-    PathfindingWorker* worker = new PathfindingWorker(data);
-    worker->moveToThread(thread);
+    if (m_isLoop) {
+        if (m_wps.count() < 2) {
+            emit pathfindingFailed("Loop requires at least 2 waypoints.");
+            return;
+        }
+    }
+    else {
+        if (!m_hasStart || !m_hasGoal) {
+            emit pathfindingFailed("Start or Goal not set.");
+            return;
+        }
+    }
 
-    connect(thread, &QThread::started, worker, &PathfindingWorker::process);
-    connect(worker, &PathfindingWorker::progressChanged, this, &MapView::onPathfindingProgress);
-    connect(worker, &PathfindingWorker::finished, this, &MapView::onPathfindingFinished);
+    PathfindingWorker::InputData data = pathfindingInput();
+    m_cancel = std::make_shared<std::atomic<bool>>(false);
+    data.cancel = m_cancel;
 
-    connect(worker, &PathfindingWorker::finished, thread, &QThread::quit);
-    connect(worker, &PathfindingWorker::finished, worker, &QObject::deleteLater);
-    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    // 常駐スレッドのキューに積む (結果は m_jobId と一致するものだけ受け取る)
+    m_jobId = m_planner->submit(data);
 
     m_isFinding = true;
     emit isFindingPathChanged();
-    thread->start();
+}
+
+void MapView::requestLiveReplan()
+{
+    // ドラッグ中の変更は LiveReplanDebounceMs の間止まるまで待ってから再計画する (変更のたびに待ち時間をやり直す)
+    m_liveTimer->start();
+}
+
+void MapView::runLiveReplan()
+{
+    if (!m_liveReplan || m_isFinding || !hasPathEndpoints()) return;
+
+    // 実行中の再計画は打ち切らずに終わるのを待つ (重い区間が毎回中止されて結果が出なくなるのを避ける)
+    if (m_liveJob) {
+        m_livePending = true;
+        return;
+    }
+
+    PathfindingWorker::InputData data = pathfindingInput();
+    m_cancel = std::make_shared<std::atomic<bool>>(false);
+    data.cancel = m_cancel;
+    m_jobId = m_planner->submit(data);
+    m_liveJob = true;
+    m_livePending = false;
+}
+
+void MapView::stopLiveReplan()
+{
+    m_liveTimer->stop();
+    m_livePending = false;
+    if (!m_liveJob) return;
+    if (m_cancel) m_cancel->store(true);
+    m_jobId = 0;
+    m_liveJob = false;
+}
+
+void MapView::onLiveReplanFinished(const QList<QList<QPointF>>& segments, bool failed, int failIdx)
+{
+    m_jobId = 0;
+    m_liveJob = false;
+
+    // ドラッグ中は失敗してもダイアログは出さず、失敗した区間の表示だけを更新する
+    m_pfFail = failed;
+    m_failSegIdx = failed ? failIdx : -1;
+    if (failed) m_segs.clear();
+    else m_segs = segments;
+    update();
+
+    if (m_livePending) runLiveReplan();
+}
+
+void MapView::cancelFindPath()
+{
+    stopLiveReplan();
+    // 実行中のワーカーは数ミリ秒以内に探索を打ち切って終了する (結果は受け取らない)
+    if (!m_isFinding) return;
+    if (m_cancel) m_cancel->store(true);
+    m_jobId = 0;
+    m_isFinding = false;
+    emit isFindingPathChanged();
 }
 
 void MapView::onPathfindingProgress(float p) {
@@ -1175,12 +1569,34 @@ void MapView::regeneratePathfinderGrid() {
         cfg.mode = 0;
         cfg.safeThresh = m_safeThresh;
         cfg.edgeThresh = m_edgeThresh;
+        // 表示する占有グリッドは探索と同じく robotAngle の向きのレイヤー
+        cfg.orientedFootprint = m_orientedFootprint;
+        cfg.robotAngle = float(m_robotAng);
 
         m_finder->setConfig(cfg);
         m_finder->generateConfigurationSpace();
     }
 }
 
+// 障害物1件の変更を差分反映する (C-Space の影響範囲のみ再生成)
+void MapView::pathfinderObstacleInserted(int idx) {
+    if (m_finder && idx >= 0 && idx < m_obs.size()) {
+        m_finder->insertObstacle(idx, m_obs.at(idx));
+    }
+}
+
+void MapView::pathfinderObstacleRemoved(int idx) {
+    if (m_finder) {
+        m_finder->removeObstacle(idx);
+    }
+}
+
+void MapView::pathfinderObstacleMoved(int idx) {
+    if (m_finder && idx >= 0 && idx < m_obs.size()) {
+        m_finder->moveObstacle(idx, m_obs.at(idx));
+    }
+}
+
 void MapView::undo() { m_undo->undo(); }
 void MapView::redo() { m_undo->redo(); }
 
@@ -1228,7 +1644,8 @@ void MapView::updateMoving(const QPointF& viewPos)
         if (delta.manhattanLength() > 0.001) {
             m_wps[m_moveWpIdx] += delta;
             m_lastSnapPos = m_snapPos;
-            m_segs.clear();
+            if (m_liveReplan) requestLiveReplan();
+            else m_segs.clear();
             update();
         }
     }
@@ -1237,8 +1654,9 @@ void MapView::updateMoving(const QPointF& viewPos)
         if (delta.manhattanLength() > 0.001) {
             m_obs[m_moveObsIdx].translate(delta);
             m_lastSnapPos = m_snapPos;
-            regeneratePathfinderGrid();
-            m_segs.clear();
+            pathfinderObstacleMoved(m_moveObsIdx);
+            if (m_liveReplan) requestLiveReplan();
+            else m_segs.clear();
             update();
         }
     }
@@ -1248,17 +1666,26 @@ void MapView::finishMoving(const QPointF& viewPos)
 {
     Q_UNUSED(viewPos);
 
+    bool moved = false;
     if (m_moveWpIdx != -1) {
         if (m_wps[m_moveWpIdx] != m_moveStartPos) {
             m_undo->push(new MoveWaypointCommand(this, m_moveWpIdx, m_moveStartPos, m_wps[m_moveWpIdx]));
+            moved = true;
         }
     }
     else if (m_moveObsIdx != -1) {
         if (m_obs[m_moveObsIdx] != m_moveStartRect) {
             m_undo->push(new MoveObstacleCommand(this, m_moveObsIdx, m_moveStartRect, m_obs[m_moveObsIdx]));
+            moved = true;
         }
     }
 
+    // 離した位置の経路をすぐに求める (ドラッグ中の古い位置の再計画は中止する)
+    if (moved && m_liveReplan && !m_isFinding) {
+        stopLiveReplan();
+        runLiveReplan();
+    }
+
     m_moveWpIdx = -1;
     m_moveObsIdx = -1;
 }
@@ -9,9 +9,11 @@
 #include <QList>
 #include <QRectF>
 #include <memory>
+#include <atomic>
 #include <QTimer>
 #include <QUndoStack>
 #include <QThread>
+#include <QElapsedTimer>
 
 namespace Pathfinding {
     class Pathfinder;
@@ -23,7 +25,10 @@ class AddWaypointCommand;
 class DeleteWaypointCommand;
 class MoveWaypointCommand;
 
-// 探索ワーカースレッド用クラス
+// 探索間で引き継ぐ状態 (モード別の Pathfinder と、その区間ごとの差分再計画の状態)
+struct PathfindingSession;
+
+// 探索ワーカー (PlannerService の常駐スレッド上で動作し、探索間で Pathfinder を使い回す)
 class PathfindingWorker : public QObject {
     Q_OBJECT
 public:
@@ -36,6 +41,10 @@ public:
         int mode; // MapView::PathMode
         bool useWpField;
         bool isLoop;
+        bool anyAngle; // Lazy Theta* で折れ点だけの経路を求める
+        bool orientedFootprint; // 障害物をロボットの向きを考慮した外形で膨張する (通れない区間は向きを選び直す)
+        bool visibilityGraph; // グリッドを使わず、矩形障害物の可視グラフで厳密な最短経路を求める
+        float robotAngle; // 度
         int pfMode; // MapView::PathfindingMode
         float tension;
         int iter;
@@ -45,19 +54,55 @@ public:
         QList<QPointF> wps;
         QList<int> wpModes; // 0 or 1
         QList<QRectF> obstacles;
+
+        // 中止要求 (MapView が true にすると探索を打ち切る)
+        std::shared_ptr<std::atomic<bool>> cancel;
+
+        // 受け付けた時刻 (探索開始までの待ち時間の計測用)
+        QElapsedTimer submitted;
     };
 
-    explicit PathfindingWorker(const InputData& data, QObject* parent = nullptr);
+    explicit PathfindingWorker(QObject* parent = nullptr);
+    ~PathfindingWorker();
 
 public slots:
-    void process();
+    void process(quint64 job, const InputData& data);
 
 signals:
-    void progressChanged(float progress);
-    void finished(const QList<QList<QPointF>>& segments, bool failed, int failIdx, QString msg);
+    void started(quint64 job, qint64 latencyNs);
+    void progressChanged(quint64 job, float progress);
+    void finished(quint64 job, const QList<QList<QPointF>>& segments, bool failed, int failIdx, QString msg);
 
 private:
     InputData m_data;
+    quint64 m_job = 0;
+
+    // 前回の探索結果を引き継ぐためのセッション (障害物の差分だけを反映して再計画する)
+    std::unique_ptr<PathfindingSession> m_session;
+};
+
+// 探索の常駐スレッド
+// 受け付けたジョブはスレッドのイベントキューに順に積み、1つのワーカーで処理する
+// (要求ごとのスレッド生成・破棄が無く、Pathfinder のレイヤー・作業領域も温まったまま使い回す)
+class PlannerService : public QObject {
+    Q_OBJECT
+public:
+    explicit PlannerService(QObject* parent = nullptr);
+    ~PlannerService();
+
+    // ジョブを積み、ジョブ番号 (1 から連番) を返す。data.cancel で中止できる
+    quint64 submit(PathfindingWorker::InputData data);
+
+signals:
+    // latencyNs: 受け付けから探索開始までの時間
+    void started(quint64 job, qint64 latencyNs);
+    void progressChanged(quint64 job, float progress);
+    void finished(quint64 job, const QList<QList<QPointF>>& segments, bool failed, int failIdx, QString msg);
+
+private:
+    QThread m_thread;
+    PathfindingWorker* m_worker;
+    quint64 m_lastJob = 0;
 };
 
 class MapView : public QQuickPaintedItem
@@ -101,10 +146,16 @@ class MapView : public QQuickPaintedItem
         Q_PROPERTY(int smoothingIterations READ smoothingIterations WRITE setSmoothingIterations NOTIFY smoothingIterationsChanged)
         Q_PROPERTY(int guidanceStrength READ guidanceStrength WRITE setGuidanceStrength NOTIFY guidanceStrengthChanged)
         Q_PROPERTY(bool loopPath READ loopPath WRITE setLoopPath NOTIFY loopPathChanged)
+        Q_PROPERTY(bool anyAnglePath READ anyAnglePath WRITE setAnyAnglePath NOTIFY anyAnglePathChanged)
+        Q_PROPERTY(bool orientedFootprint READ orientedFootprint WRITE setOrientedFootprint NOTIFY orientedFootprintChanged)
+        Q_PROPERTY(bool visibilityGraph READ visibilityGraph WRITE setVisibilityGraph NOTIFY visibilityGraphChanged)
+        Q_PROPERTY(bool supersedeSearch READ supersedeSearch WRITE setSupersedeSearch NOTIFY supersedeSearchChanged)
+        Q_PROPERTY(bool liveReplan READ liveReplan WRITE setLiveReplan NOTIFY liveReplanChanged)
 
         // 進捗表示用プロパティ
         Q_PROPERTY(bool isFindingPath READ isFindingPath NOTIFY isFindingPathChanged)
         Q_PROPERTY(float searchProgress READ searchProgress NOTIFY searchProgressChanged)
+        Q_PROPERTY(qreal plannerLatencyMs READ plannerLatencyMs NOTIFY plannerLatencyChanged)
 
 public:
     explicit MapView(QQuickItem* parent = nullptr);
@@ -212,10 +263,21 @@ public:
     void setGuidanceStrength(int s);
     bool loopPath() const;
     void setLoopPath(bool loop);
+    bool anyAnglePath() const;
+    void setAnyAnglePath(bool anyAngle);
+    bool orientedFootprint() const;
+    void setOrientedFootprint(bool oriented);
+    bool visibilityGraph() const;
+    void setVisibilityGraph(bool visibility);
+    bool supersedeSearch() const;
+    void setSupersedeSearch(bool supersede);
+    bool liveReplan() const;
+    void setLiveReplan(bool live);
 
     // プロパティゲッター
     bool isFindingPath() const { return m_isFinding; }
     float searchProgress() const { return m_progress; }
+    qreal plannerLatencyMs() const { return m_plannerLatencyNs / 1e6; } // 直近の探索の受け付けから開始までの時間
 
     void loadMapData(int res, int w, int h, float robotW, float robotH,
         int smoothIter, const QString& searchMode,
@@ -241,6 +303,7 @@ public slots:
     void setGoalPoint();
     void setLoopStartPoint();
     void findPath();
+    void cancelFindPath();
     void undo();
     void redo();
     void confirmLoopModeActivation();
@@ -275,16 +338,23 @@ signals:
     void smoothingIterationsChanged();
     void guidanceStrengthChanged();
     void loopPathChanged();
+    void anyAnglePathChanged();
+    void orientedFootprintChanged();
+    void visibilityGraphChanged();
+    void supersedeSearchChanged();
+    void liveReplanChanged();
     void requestLoopModeConfirmation();
     void requestNonLoopModeConfirmation();
 
     // 追加シグナル
     void isFindingPathChanged();
     void searchProgressChanged();
+    void plannerLatencyChanged();
 
 private slots:
     void onPathfindingFinished(const QList<QList<QPointF>>& segments, bool failed, int failIdx, const QString& msg);
     void onPathfindingProgress(float p);
+    void runLiveReplan();
 
 private:
     void handleLeftClickInWaypointMode(const QPointF& worldPos, bool isCtrlPressed);
@@ -298,6 +368,9 @@ private:
     void cullOutOfBoundsObjects();
     void setSelectedWaypointIndex(int index);
     void regeneratePathfinderGrid();
+    void pathfinderObstacleInserted(int idx);
+    void pathfinderObstacleRemoved(int idx);
+    void pathfinderObstacleMoved(int idx);
     void clearPathItems();
 
     qreal m_scale = 1.0;
@@ -350,6 +423,11 @@ private:
     int m_iter = 3;
     int m_guideStr = 0;
     bool m_isLoop = false;
+    bool m_anyAngle = false;
+    bool m_orientedFootprint = false; // robotAngle の向きの長方形で C-Space を作る
+    bool m_visibilityGraph = false;   // 可視グラフで探索する
+    bool m_supersede = false; // 探索中に findPath() が呼ばれたら実行中の探索を中止して新しく始める
+    bool m_liveReplan = false; // ウェイポイント・障害物のドラッグ中に経路を再計画し続ける
 
     bool m_pfFail = false;
     int m_failSegIdx = -1;
@@ -361,8 +439,26 @@ private:
     QPointF m_lastSnapPos;
 
     // スレッド管理
+    PlannerService* m_planner;
     bool m_isFinding = false;
     float m_progress = 0.0f;
+
+    // 実行中の探索の中止要求と番号 (中止・置き換えた探索の結果と進捗は受け取らない)
+    std::shared_ptr<std::atomic<bool>> m_cancel;
+    quint64 m_jobId = 0;
+    qint64 m_plannerLatencyNs = 0;
+
+    // ドラッグ中の再計画 (m_liveJob: m_jobId が再計画のジョブ、m_livePending: 実行中に位置が変わった)
+    static constexpr int LiveReplanDebounceMs = 30;
+    QTimer* m_liveTimer;
+    bool m_liveJob = false;
+    bool m_livePending = false;
+
+    bool hasPathEndpoints() const;
+    PathfindingWorker::InputData pathfindingInput() const;
+    void requestLiveReplan();
+    void stopLiveReplan();
+    void onLiveReplanFinished(const QList<QList<QPointF>>& segments, bool failed, int failIdx);
 };
 
 #endif // MAPVIEW_H
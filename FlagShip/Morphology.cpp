@@ -0,0 +1,202 @@
+﻿#include "Morphology.h"
+#include <cmath>
+#include <algorithm>
+
+namespace Pathfinding {
+
+    namespace Morphology {
+
+        void maxFilter(const uint8_t* in, uint8_t* out, int n, int radius, std::vector<uint8_t>& work)
+        {
+            if (n <= 0) return;
+            if (radius <= 0) {
+                std::copy(in, in + n, out);
+                return;
+            }
+
+            // 両端に radius 個の 0 を足した列を窓の長さ k ごとのブロックに分け、
+            // ブロック内の前方累積最大 g と後方累積最大 h を求めると、窓 [i, i + k) の最大は max(h[i], g[i + k - 1])
+            const int k = 2 * radius + 1;
+            const int m = n + 2 * radius;
+            if (work.size() < size_t(3 * m)) work.resize(size_t(3 * m));
+            uint8_t* ext = work.data();
+            uint8_t* g = ext + m;
+            uint8_t* h = g + m;
+            std::fill(ext, ext + radius, uint8_t(0));
+            std::copy(in, in + n, ext + radius);
+            std::fill(ext + radius + n, ext + m, uint8_t(0));
+
+            for (int start = 0; start < m; start += k) {
+                const int end = std::min(m, start + k);
+                g[start] = ext[start];
+                for (int i = start + 1; i < end; ++i) g[i] = std::max(g[i - 1], ext[i]);
+                h[end - 1] = ext[end - 1];
+                for (int i = end - 2; i >= start; --i) h[i] = std::max(h[i + 1], ext[i]);
+            }
+            for (int i = 0; i < n; ++i) {
+                out[i] = std::max(h[i], g[i + k - 1]);
+            }
+        }
+
+        void dilateRect(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+            int width, int height, int rx, int ry, std::vector<uint8_t>& tmp)
+        {
+            if (width <= 0 || height <= 0) return;
+
+            // 行方向 (全て 0 の行は結果も 0 なので、その行はフィルタを掛けずに記録だけしておく)
+            std::vector<uint8_t> work;
+            std::vector<int> nonzero(size_t(height) + 1, 0);
+            tmp.resize(size_t(width) * size_t(height));
+            for (int y = 0; y < height; ++y) {
+                const uint8_t* in = src + size_t(y) * srcStride;
+                uint8_t* out = tmp.data() + size_t(y) * width;
+                const bool any = std::any_of(in, in + width, [](uint8_t v) { return v != 0; });
+                if (any) maxFilter(in, out, width, rx, work);
+                else std::fill(out, out + width, uint8_t(0));
+                nonzero[size_t(y) + 1] = nonzero[size_t(y)] + (any ? 1 : 0);
+            }
+            auto rowsNonzero = [&](int y0, int y1) {
+                return nonzero[size_t(std::min(height, y1 + 1))] - nonzero[size_t(std::max(0, y0))] > 0;
+            };
+
+            // 列方向: maxFilter と同じブロック分割を行単位で行う (各行の全列をまとめて比べるため連続に読み書きできる)
+            // 上下 ry 行以内に 0 でない行がある出力行の帯だけを処理する
+            const int k = 2 * std::max(0, ry) + 1;
+            const std::vector<uint8_t> zero(size_t(width), 0);
+            std::vector<uint8_t> g, h;
+            int y = 0;
+            while (y < height) {
+                if (!rowsNonzero(y - ry, y + ry)) {
+                    std::fill(dst + size_t(y) * dstStride, dst + size_t(y) * dstStride + width, uint8_t(0));
+                    ++y;
+                    continue;
+                }
+                const int y0 = y;
+                while (y < height && rowsNonzero(y - ry, y + ry)) ++y;
+                const int y1 = y;
+
+                if (ry <= 0) {
+                    for (int r = y0; r < y1; ++r) {
+                        std::copy(tmp.data() + size_t(r) * width, tmp.data() + size_t(r + 1) * width, dst + size_t(r) * dstStride);
+                    }
+                    continue;
+                }
+
+                // 帯の出力行 [y0, y1) に必要な入力行 [y0 - ry, y1 + ry) を i = 0.. として並べる (画像外は 0)
+                const int m = (y1 - y0) + 2 * ry;
+                auto ext = [&](int i) {
+                    const int r = y0 - ry + i;
+                    return (r < 0 || r >= height) ? zero.data() : tmp.data() + size_t(r) * width;
+                };
+                if (g.size() < size_t(m) * width) {
+                    g.resize(size_t(m) * width);
+                    h.resize(size_t(m) * width);
+                }
+                auto gRow = [&](int i) { return g.data() + size_t(i) * width; };
+                auto hRow = [&](int i) { return h.data() + size_t(i) * width; };
+                for (int start = 0; start < m; start += k) {
+                    const int end = std::min(m, start + k);
+                    std::copy(ext(start), ext(start) + width, gRow(start));
+                    for (int i = start + 1; i < end; ++i) {
+                        const uint8_t* prev = gRow(i - 1);
+                        const uint8_t* in = ext(i);
+                        uint8_t* out = gRow(i);
+                        for (int x = 0; x < width; ++x) out[x] = std::max(prev[x], in[x]);
+                    }
+                    std::copy(ext(end - 1), ext(end - 1) + width, hRow(end - 1));
+                    for (int i = end - 2; i >= start; --i) {
+                        const uint8_t* next = hRow(i + 1);
+                        const uint8_t* in = ext(i);
+                        uint8_t* out = hRow(i);
+                        for (int x = 0; x < width; ++x) out[x] = std::max(next[x], in[x]);
+                    }
+                }
+                for (int r = y0; r < y1; ++r) {
+                    const uint8_t* a = hRow(r - y0);
+                    const uint8_t* b = gRow(r - y0 + k - 1);
+                    uint8_t* out = dst + size_t(r) * dstStride;
+                    for (int x = 0; x < width; ++x) out[x] = std::max(a[x], b[x]);
+                }
+            }
+        }
+
+        void dilateLine(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+            int width, int height, double angle, double length, int originX, int originY)
+        {
+            if (width <= 0 || height <= 0) return;
+            const double c = std::cos(angle);
+            const double s = std::sin(angle);
+
+            // 主軸 (|cos| >= |sin| なら x) に沿って1ずつ進み、副軸は slope ずつ進むデジタル直線
+            // 主軸の各位置で副軸の値が1つに決まるため、切片 (副軸の開始位置) を全て並べると各画素を1回ずつ通る
+            const bool xMajor = std::abs(c) >= std::abs(s);
+            const int lineLen = xMajor ? width : height;
+            const int lineCount = xMajor ? height : width;
+            const double slope = xMajor ? s / c : c / s;
+            // 線分の主軸方向の広がり (片側のサンプル数。端数は切り上げて線分を覆う)
+            const int radius = int(std::ceil(0.5 * length * (xMajor ? std::abs(c) : std::abs(s)) - 1e-9));
+
+            // 主軸の位置 a での副軸のずれ (全ての直線で共通)。窓の位置に依らないよう全体座標で丸める
+            const int origin = xMajor ? originX : originY;
+            const long base = std::lround(origin * slope);
+            std::vector<int> shift(static_cast<size_t>(lineLen));
+            for (int a = 0; a < lineLen; ++a) shift[size_t(a)] = int(std::lround((a + origin) * slope) - base);
+            const int drift = shift[size_t(lineLen - 1)];
+            const int first = std::min(0, -drift);
+            const int last = std::max(lineCount - 1, lineCount - 1 - drift);
+
+            std::vector<int> srcOffs(static_cast<size_t>(lineLen)), dstOffs(static_cast<size_t>(lineLen));
+            std::vector<uint8_t> line(static_cast<size_t>(lineLen)), filtered(static_cast<size_t>(lineLen)), work;
+
+            for (int b = first; b <= last; ++b) {
+                int n = 0;
+                for (int a = 0; a < lineLen; ++a) {
+                    const int v = b + shift[size_t(a)];
+                    if (v < 0 || v >= lineCount) continue;
+                    const int x = xMajor ? a : v;
+                    const int y = xMajor ? v : a;
+                    srcOffs[size_t(n)] = y * srcStride + x;
+                    dstOffs[size_t(n)] = y * dstStride + x;
+                    line[size_t(n)] = src[srcOffs[size_t(n)]];
+                    ++n;
+                }
+                if (n == 0) continue;
+                // 画像内の部分は主軸方向に連続しているため、そのまま1次元の最大値フィルタを掛けられる
+                maxFilter(line.data(), filtered.data(), n, radius, work);
+                for (int i = 0; i < n; ++i) dst[dstOffs[size_t(i)]] = filtered[size_t(i)];
+            }
+        }
+
+        void dilateRotatedRect(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+            int width, int height, double angle, double w, double h, std::vector<uint8_t>& tmp,
+            int originX, int originY)
+        {
+            if (width <= 0 || height <= 0) return;
+            tmp.assign(size_t(width) * size_t(height), 0);
+            dilateLine(src, srcStride, tmp.data(), width, width, height, angle, w, originX, originY);
+
+            // 斜めのデジタル直線は8連結なので、直交する直線で掃くと市松模様の穴が残る
+            // 1つ目の直線を主軸方向に1画素太らせて4連結にしてから掃く (膨張は片側に最大1画素大きくなる)
+            const double c = std::abs(std::cos(angle));
+            const double s = std::abs(std::sin(angle));
+            if (std::min(c, s) > 1e-9) {
+                if (c >= s) {
+                    for (int y = 0; y < height; ++y) {
+                        uint8_t* row = tmp.data() + size_t(y) * size_t(width);
+                        for (int x = width - 1; x > 0; --x) row[x] |= row[x - 1];
+                    }
+                }
+                else {
+                    for (int y = height - 1; y > 0; --y) {
+                        uint8_t* row = tmp.data() + size_t(y) * size_t(width);
+                        const uint8_t* above = row - width;
+                        for (int x = 0; x < width; ++x) row[x] |= above[x];
+                    }
+                }
+            }
+            dilateLine(tmp.data(), width, dst, dstStride, width, height, angle + 1.5707963267948966, h, originX, originY);
+        }
+
+    }
+
+}
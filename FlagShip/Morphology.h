@@ -0,0 +1,42 @@
+﻿#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include <vector>
+#include <cstdint>
+
+namespace Pathfinding {
+
+    // 2値画像 (0/1) のモルフォロジー膨張
+    // 画像は width x height の範囲を stride 間隔の行で参照する (余白付きグリッドの一部分も渡せる)
+    namespace Morphology {
+
+        // 1次元の最大値フィルタ (van Herk / Gil-Werman)
+        // out[i] = max(in[i - radius .. i + radius])。範囲外は 0 とみなす
+        // 窓の長さに依らず1要素あたり比較3回で求まる。work は作業領域
+        void maxFilter(const uint8_t* in, uint8_t* out, int n, int radius, std::vector<uint8_t>& work);
+
+        // (2 * rx + 1) x (2 * ry + 1) セルの長方形で膨張する (行方向・列方向の maxFilter に分けて掛ける)
+        // 画像外は 0 とみなす。src と dst は同じでもよい。tmp は作業領域
+        void dilateRect(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+            int width, int height, int rx, int ry, std::vector<uint8_t>& tmp);
+
+        // 中心対称な長さ length (セル) の線分で膨張する。angle は線分の向き (ラジアン, x 軸から y 軸方向)
+        // 線分の向きに平行なデジタル直線 (Bresenham) で画像を重複なく覆い、各直線に maxFilter を掛ける
+        // src と dst は同じ寸法で、別の領域であること
+        // デジタル直線は (originX, originY) を画像の左上とする全体座標で引くため、同じ全体の一部分を
+        // 別の窓で膨張しても、窓の端から十分離れた画素の結果は一致する
+        void dilateLine(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+            int width, int height, double angle, double length, int originX = 0, int originY = 0);
+
+        // angle だけ回転した w x h (セル) の長方形で膨張する
+        // 長方形は直交する2本の線分のミンコフスキー和なので、線分の膨張を2回行う (tmp は作業領域)
+        // 途中結果も窓の端で欠けるため、窓の端から (w + h) / 2 以内の画素は正しくない
+        void dilateRotatedRect(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+            int width, int height, double angle, double w, double h, std::vector<uint8_t>& tmp,
+            int originX = 0, int originY = 0);
+
+    }
+
+}
+
+#endif // MORPHOLOGY_H
@@ -0,0 +1,74 @@
+﻿#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+namespace Pathfinding {
+
+    // [begin, end) の各インデックスに対して fn(i) を並列実行する
+    // grain 個ずつのチャンクを共有カウンタから取り出して処理する
+    // 呼び出し元スレッドも処理に参加し、まだ開始されていない補助タスクは tryTake で回収するため、
+    // スレッドプール上から入れ子で呼び出してもデッドロックしない
+    template <typename Fn>
+    void parallelFor(int begin, int end, Fn&& fn, int grain = 1)
+    {
+        if (end <= begin) return;
+        grain = std::max(1, grain);
+        const int chunks = (end - begin + grain - 1) / grain;
+
+        QThreadPool* pool = QThreadPool::globalInstance();
+        const int helpers = std::min(chunks, pool->maxThreadCount()) - 1;
+        if (helpers <= 0) {
+            for (int i = begin; i < end; ++i) fn(i);
+            return;
+        }
+
+        std::atomic<int> next(0);
+        auto drain = [&]() {
+            for (int c = next.fetch_add(1); c < chunks; c = next.fetch_add(1)) {
+                const int first = begin + c * grain;
+                const int last = std::min(end, first + grain);
+                for (int i = first; i < last; ++i) fn(i);
+            }
+        };
+
+        class Task : public QRunnable {
+        public:
+            Task(decltype(drain)& work, QSemaphore& done) : m_work(work), m_done(done) { setAutoDelete(false); }
+            void run() override {
+                m_work();
+                m_done.release();
+            }
+
+        private:
+            decltype(drain)& m_work;
+            QSemaphore& m_done;
+        };
+
+        QSemaphore done;
+        std::vector<std::unique_ptr<Task>> tasks;
+        tasks.reserve(size_t(helpers));
+        for (int t = 0; t < helpers; ++t) {
+            tasks.emplace_back(new Task(drain, done));
+            pool->start(tasks.back().get());
+        }
+
+        drain();
+
+        // 開始前のタスクは取り消し、実行中のものだけ完了を待つ
+        int running = 0;
+        for (auto& task : tasks) {
+            if (!pool->tryTake(task.get())) ++running;
+        }
+        done.acquire(running);
+    }
+
+}
+
+#endif // PARALLEL_H
@@ -1,19 +1,85 @@
 ﻿#include "Pathfinder.h"
+#include "Parallel.h"
+#include "Morphology.h"
 #include <cmath>
 #include <queue>
 #include <vector>
+#include <algorithm>
+#include <limits>
+#include <atomic>
 #include <QDebug>
 #include <QLineF>
+#include <QElapsedTimer>
 
 namespace Pathfinding {
 
-    struct CompareNode {
-        bool operator()(const Node* a, const Node* b) const {
-            return *a > *b;
+    namespace {
+        // FNV-1a による設定値のハッシュ
+        class KeyHasher {
+        public:
+            template <typename T>
+            void add(const T& v) {
+                const unsigned char* p = reinterpret_cast<const unsigned char*>(&v);
+                for (size_t i = 0; i < sizeof(T); ++i) {
+                    m_hash ^= p[i];
+                    m_hash *= 1099511628211ull;
+                }
+            }
+            quint64 value() const { return m_hash; }
+
+        private:
+            quint64 m_hash = 1469598103934665603ull;
+        };
+
+        // 中心 (x + 0.5) * res が [lo, hi] に含まれるセルの範囲 [first, last] (QRectF::contains と同じ比較)
+        void cellCentersWithin(qreal lo, qreal hi, int res, int& first, int& last)
+        {
+            first = qCeil(lo / res - 0.5);
+            while ((first - 0.5) * res >= lo) --first;
+            while ((first + 0.5) * res < lo) ++first;
+            last = qFloor(hi / res - 0.5);
+            while ((last + 1.5) * res <= hi) ++last;
+            while ((last + 0.5) * res > hi) --last;
         }
-    };
+
+        constexpr float EdtInfinity = std::numeric_limits<float>::infinity();
+
+        // 1次元の2乗距離変換 (Felzenszwalb & Huttenlocher)
+        // d[i] = min_q ((i - q)^2 + f[q]) を放物線の下側包絡から O(n) で求める。f[q] が無限大の標本は除外する
+        // v, z は n 要素の作業領域
+        void squaredDistance1D(const float* f, float* d, int n, int* v, double* z)
+        {
+            int k = -1;
+            for (int q = 0; q < n; ++q) {
+                if (f[q] == EdtInfinity) continue;
+                const double fq = double(f[q]) + double(q) * q;
+                double s = -std::numeric_limits<double>::infinity();
+                while (k >= 0) {
+                    const int vk = v[k];
+                    s = (fq - (double(f[vk]) + double(vk) * vk)) / (2.0 * (q - vk));
+                    if (s > z[k]) break;
+                    s = -std::numeric_limits<double>::infinity();
+                    --k;
+                }
+                ++k;
+                v[k] = q;
+                z[k] = s;
+            }
+            if (k < 0) {
+                std::fill(d, d + n, EdtInfinity);
+                return;
+            }
+            int j = 0;
+            for (int i = 0; i < n; ++i) {
+                while (j < k && z[j + 1] < i) ++j;
+                const double di = double(i - v[j]);
+                d[i] = float(di * di + f[v[j]]);
+            }
+        }
+    }
 
     Pathfinder::Pathfinder()
+        : m_layers(std::make_shared<MapLayers>())
     {
     }
 
@@ -21,57 +87,321 @@ namespace Pathfinding {
         m_cfg = config;
         m_gridW = m_cfg.mapW;
         m_gridH = m_cfg.mapH;
+        m_headingOverride = -1;
+    }
+
+    void Pathfinder::updateConfig(const PathfinderConfig& config)
+    {
+        // 新しい設定を障害物以外について先に反映し、障害物の違いはその設定のレイヤーに差分更新で反映する
+        PathfinderConfig next = config;
+        next.obstacles = m_cfg.obstacles;
+        setConfig(next);
+        updateObstacles(config.obstacles);
     }
 
-    QList<QPoint> Pathfinder::findPath(const QPoint& start, const QPoint& goal, std::function<void(float)> progressCallback)
+    bool Pathfinder::prepareLayers()
     {
-        if (m_gridW <= 0 || m_gridH <= 0) return {};
+        if (m_gridW <= 0 || m_gridH <= 0) return false;
 
-        // グリッド再生成
+        // レイヤー準備 (同じ条件で生成済みならキャッシュから取得)
         generateConfigurationSpace();
-        if (m_cfg.mode == 0) {
-            generateDistanceField();
+        if (m_cfg.mode == 0 && m_layers->penalty.empty()) {
+            buildDistanceField(*m_layers);
         }
         if (m_cfg.useWpField) {
             generateWaypointField();
         }
+        prepareStepCost();
+        return true;
+    }
 
+    bool Pathfinder::snapEndpoints(const QPoint& start, const QPoint& goal, QPoint& s, QPoint& g) const
+    {
         // スタート/ゴールの有効性確認と補正
-        QPoint s = start;
+        s = start;
         if (!isGridPassable(s)) {
             s = findNearestPassable(s);
-            if (s.x() == -1) return {};
+            if (s.x() == -1) return false;
         }
 
-        QPoint g = goal;
+        g = goal;
         if (!isGridPassable(g)) {
             g = findNearestPassable(g);
-            if (g.x() == -1) return {};
+            if (g.x() == -1) return false;
         }
 
-        if (s.y() < 0 || s.y() >= m_gridH || s.x() < 0 || s.x() >= m_gridW ||
-            g.y() < 0 || g.y() >= m_gridH || g.x() < 0 || g.x() >= m_gridW) {
-            return {};
+        return s.y() >= 0 && s.y() < m_gridH && s.x() >= 0 && s.x() < m_gridW &&
+            g.y() >= 0 && g.y() < m_gridH && g.x() >= 0 && g.x() < m_gridW;
+    }
+
+    bool Pathfinder::prepareSearch(const QPoint& start, const QPoint& goal, QPoint& s, QPoint& g)
+    {
+        return prepareLayers() && snapEndpoints(start, goal, s, g);
+    }
+
+    QList<QPoint> Pathfinder::findPath(const QPoint& start, const QPoint& goal, std::function<void(float)> progressCallback, CancelToken cancel)
+    {
+        m_ctx.cancel = std::move(cancel);
+        m_ctx.stats = SearchStats();
+        m_headingOverride = -1;
+
+        QPoint s, g;
+        QList<QPoint> path;
+        if (prepareSearch(start, goal, s, g)) {
+            if (useHierarchical()) prepareHierarchy();
+            path = searchPrepared(m_ctx, s, g, progressCallback);
         }
 
-        // A* 探索初期化
-        std::priority_queue<Node*, std::vector<Node*>, CompareNode> openList;
-        // 注意: 巨大マップの場合、このメモリ確保が重い可能性があるが、ヒープ上なのでスタックオーバーフローはしないはず
-        std::vector<std::vector<Node>> allNodes(m_gridH, std::vector<Node>(m_gridW));
+        if (m_cfg.orientedFootprint) {
+            // robotAngle の向きで通れなければ、向きの差が小さい順に他の向きの C-Space で探索する
+            // 全ての向きの占有グリッドはここで初めて (並列に) 生成し、以降の探索で使い回す
+            const int count = std::max(1, m_cfg.headingCount);
+            const int base = headingIndex();
+            int used = base;
+            if (path.isEmpty() && m_cfg.pickHeading && count > 1 && !m_ctx.cancelled()) {
+                generateHeadingStack();
+                for (int d = 1; d <= count / 2 && path.isEmpty() && !m_ctx.cancelled(); ++d) {
+                    for (int k : { (base + d) % count, (base + count - d) % count }) {
+                        m_headingOverride = k;
+                        if (prepareSearch(start, goal, s, g)) {
+                            if (useHierarchical()) prepareHierarchy();
+                            path = searchPrepared(m_ctx, s, g, progressCallback);
+                        }
+                        if (!path.isEmpty() || m_ctx.cancelled() || 2 * d == count) break;
+                    }
+                }
+                // 見つかった場合は平滑化でもその向きのレイヤーを使う。見つからなければ元の向きのレイヤーに戻す
+                if (!path.isEmpty()) {
+                    used = m_headingOverride;
+                }
+                else {
+                    m_headingOverride = -1;
+                    prepareLayers();
+                }
+            }
+            m_ctx.stats.heading = used * 180.0 / count;
+        }
 
-        Node* startNode = &allNodes[s.y()][s.x()];
-        startNode->pos = s;
-        startNode->gCost = 0;
-        startNode->hCost = heuristic(s, g);
+        m_ctx.cancel.reset();
+        return path;
+    }
+
+    bool Pathfinder::prepareSharedSearch()
+    {
+        m_headingOverride = -1;
+        if (!prepareLayers()) return false;
+        if (useHierarchical()) prepareHierarchy();
+        return true;
+    }
+
+    QList<QPoint> Pathfinder::findPathShared(const QPoint& start, const QPoint& goal, std::function<void(float)> progressCallback,
+        CancelToken cancel, SearchStats* stats) const
+    {
+        if (!m_layers || m_layers->grid.empty()) return {};
+        QPoint s, g;
+        if (!snapEndpoints(start, goal, s, g)) return {};
+
+        // 作業領域はプールから借り、探索後に返す (同時に探索するスレッドの数だけ確保される)
+        std::unique_ptr<SearchContext> ctx;
+        {
+            QMutexLocker lock(&m_contextMutex);
+            if (!m_contextPool.empty()) {
+                ctx = std::move(m_contextPool.back());
+                m_contextPool.pop_back();
+            }
+        }
+        if (!ctx) ctx = std::make_unique<SearchContext>();
+
+        ctx->cancel = std::move(cancel);
+        ctx->stats = SearchStats();
+        QList<QPoint> path = searchPrepared(*ctx, s, g, progressCallback, true);
+        ctx->cancel.reset();
+        if (stats) *stats = ctx->stats;
+
+        QMutexLocker lock(&m_contextMutex);
+        m_contextPool.push_back(std::move(ctx));
+        return path;
+    }
+
+    QList<QPoint> Pathfinder::searchPrepared(SearchContext& ctx, const QPoint& s, const QPoint& g, const std::function<void(float)>& progressCallback, bool concurrent) const
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        // セル進入時の追加コスト (Safe ペナルティ + ウェイポイント引き寄せ)。どちらも使わなければ nullptr
+        const uint32_t* stepCost = stepCostLayer();
+
+        // 追加コストが無い (一様コストの) 場合は Jump Point Search で同じコストの経路を少ない展開数で求める
+        // 抽象グラフが用意されていなければ (prepareHierarchy() の前なら) A* で探索する
+        const bool hierarchical = useHierarchical() && m_layers->hierarchy && m_layers->hierarchy->matches(m_layers->grid);
+
+        QList<QPoint> path;
+        if (hierarchical) {
+            path = searchHierarchical(ctx, s, g);
+            if (progressCallback && !path.isEmpty()) progressCallback(1.0f);
+        }
+        else if (m_cfg.algorithm == SearchAlgorithm::Anytime) {
+            path = searchAnytime(ctx, s, g, stepCost, progressCallback);
+        }
+        else if (m_cfg.algorithm == SearchAlgorithm::AnyAngle) {
+            path = searchAnyAngle(ctx, s, g, stepCost, progressCallback);
+        }
+        else if (m_cfg.algorithm == SearchAlgorithm::Bidirectional
+            || (m_cfg.algorithm == SearchAlgorithm::Auto && stepCost && !concurrent)) {
+            // Auto でも、追加コストがあり (JPS を使えず) 他の探索と並列に動いていなければ両側から探索する
+            path = searchBidirectional(ctx, s, g, stepCost, progressCallback);
+        }
+        else if (!stepCost && m_cfg.algorithm != SearchAlgorithm::AStar) {
+            path = searchJumpPoint(ctx, s, g, progressCallback);
+        }
+        else {
+            path = searchAStar(ctx, s, g, stepCost, progressCallback);
+        }
+        if (ctx.cancelled()) path.clear();
+        ctx.stats.elapsedNs += timer.nsecsElapsed();
+        return path;
+    }
+
+    QList<QPoint> Pathfinder::findPathIncremental(int segment, const QPoint& start, const QPoint& goal, CancelToken cancel)
+    {
+        return findPathsIncremental({ SegmentQuery{ segment, start, goal } }, nullptr, std::move(cancel)).value(0);
+    }
+
+    QList<QList<QPoint>> Pathfinder::findPathsIncremental(const QList<SegmentQuery>& queries, std::function<void(float)> progressCallback, CancelToken cancel)
+    {
+        std::vector<QList<QPoint>> paths(size_t(queries.size()));
+        if (queries.isEmpty() || !prepareLayers()) return QList<QList<QPoint>>(paths.begin(), paths.end());
+
+        m_ctx.stats = SearchStats();
+        QElapsedTimer timer;
+        timer.start();
+
+        // 区間の端点・レイヤー・追加コストの組み合わせが前回と同じなら、探索状態を引き継いで差分だけ修正する
+        // 探索状態の取得・生成はここで済ませ、並列部分では各区間が自分の探索状態だけを書き換える
+        // 初めての区間 (探索状態を作り直した区間) は指定の探索エンジンで求め、D* Lite は障害物の差分更新の後の再計画にだけ使う
+        const uint32_t* stepCost = stepCostLayer();
+        const quint64 costKey = m_cfg.useWpField ? m_wpKey : 0;
+        std::vector<DStarLite*> planners(size_t(queries.size()), nullptr);
+        std::vector<char> repair(size_t(queries.size()), 0);
+        for (int i = 0; i < queries.size(); ++i) {
+            const SegmentQuery& q = queries[i];
+            QPoint s, g;
+            if (!snapEndpoints(q.start, q.goal, s, g)) continue;
+
+            // 迂回範囲は他の探索エンジンと同じ楕円コリドーに制限する (再計画で初回と違う迂回をしないように)
+            SegmentPlanner& sp = m_segmentPlanners[q.segment];
+            const int corridor = corridorLimit(s, g);
+            if (sp.layers.lock() != m_layers || sp.costKey != costKey || (sp.planner.planned() && !sp.planner.matches(m_layers->grid))
+                || sp.planner.start() != s || sp.planner.goal() != g || sp.planner.corridor() != corridor) {
+                sp.planner.reset(s, g, corridor);
+                sp.layers = m_layers;
+                sp.costKey = costKey;
+                sp.edited = false;
+            }
+            planners[size_t(i)] = &sp.planner;
+            repair[size_t(i)] = sp.edited;
+        }
+        if (std::count(repair.begin(), repair.end(), 0) > 0 && useHierarchical()) prepareHierarchy();
+
+        // 各区間はレイヤーを読むだけなので並列に探索できる (進捗は完了した区間数で通知する)
+        const OccupancyGrid& grid = m_layers->grid;
+        std::vector<int> expansions(size_t(queries.size()), 0);
+        std::atomic<int> done(0);
+        parallelFor(0, int(queries.size()), [&](int i) {
+            if (DStarLite* planner = planners[size_t(i)]) {
+                if (repair[size_t(i)]) {
+                    paths[size_t(i)] = planner->plan(grid, stepCost, &expansions[size_t(i)], cancel.get());
+                }
+                else {
+                    SearchStats stats;
+                    paths[size_t(i)] = findPathShared(queries[i].start, queries[i].goal, nullptr, cancel, &stats);
+                    expansions[size_t(i)] = stats.expansions;
+                }
+            }
+            const int finished = done.fetch_add(1) + 1;
+            if (progressCallback) progressCallback(float(finished) / float(queries.size()));
+        });
+
+        for (int e : expansions) m_ctx.stats.expansions += e;
+        m_ctx.stats.elapsedNs = timer.nsecsElapsed();
+        return QList<QList<QPoint>>(paths.begin(), paths.end());
+    }
+
+    void Pathfinder::discardIncremental(int firstSegment)
+    {
+        m_segmentPlanners.erase(m_segmentPlanners.lower_bound(firstSegment), m_segmentPlanners.end());
+    }
+
+    QList<QPointF> Pathfinder::findVisibilityPath(const QPointF& start, const QPointF& goal)
+    {
+        m_ctx.stats = SearchStats();
+        const int res = m_cfg.resolution;
+        if (res <= 0 || m_gridW <= 0 || m_gridH <= 0) return {};
+        QElapsedTimer timer;
+        timer.start();
+
+        const quint64 key = footprintKey();
+        if (!m_visibility.isBuilt() || key != m_visibilityKey) {
+            // 通行範囲は C-Space と同じく、縁から edgeThresh (セル単位に切り上げ) の帯を除いた範囲
+            const int edge = m_cfg.edgeThresh > 0 ? qCeil(m_cfg.edgeThresh / res) : 0;
+            const QRectF bounds(edge * res, edge * res, (m_gridW - 2 * edge) * res, (m_gridH - 2 * edge) * res);
+            m_visibility.build(m_cfg.obstacles, inflation(), bounds);
+            m_visibilityKey = key;
+        }
+
+        QList<QPointF> path = m_visibility.findPath(start, goal, &m_ctx.stats.expansions);
+        m_ctx.stats.elapsedNs = timer.nsecsElapsed();
+        return path;
+    }
+
+    void Pathfinder::relax(SearchContext& ctx, int idx, int newG, int parent, int h) const
+    {
+        // より安い経路が見つかったセルを Open にする。既に Open ならキーを下げる
+        // (Closed のセルと改善しない場合は呼び出し側で除外済み)
+        const bool inOpen = ctx.ws.isSeen(idx);
+        ctx.ws.open(idx, newG, parent);
+        if (inOpen) {
+            ctx.open.decrease(idx, uint32_t(newG + h));
+            ++ctx.stats.decreases;
+        }
+        else {
+            ctx.open.push(idx, uint32_t(newG + h));
+            ++ctx.stats.pushes;
+        }
+    }
+
+    int Pathfinder::corridorLimit(const QPoint& s, const QPoint& g) const
+    {
+        // 探索範囲の制限 (楕円コリドー)。s→n→g のヒューリスティック距離がこれを超えるセルは探索しない
+        return int(m_cfg.detourFact * heuristic(s, g)) + m_cfg.detourMargin * 10;
+    }
+
+    QList<QPoint> Pathfinder::searchAStar(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const
+    {
+        const OccupancyGrid& occ = m_layers->grid;
+
+        // A* 探索初期化 (作業領域は世代番号でリセットされ、再確保は初回のみ)
+        ctx.ws.prepare(occ.size());
+        ctx.open.reset(occ.size());
+
+        const int startIdx = occ.index(s);
+        const int goalIdx = occ.index(g);
+        ctx.ws.open(startIdx, 0, -1);
 
-        // 探索範囲の制限 (楕円コリドー)
         const int lowerBound = heuristic(s, g);
-        const int limitCost = int(m_cfg.detourFact * lowerBound) + m_cfg.detourMargin * 10;
+        const int limitCost = corridorLimit(s, g);
 
-        openList.push(startNode);
+        ctx.open.push(startIdx, uint32_t(lowerBound));
+        ++ctx.stats.pushes;
 
-        int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
-        int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+        // 8近傍のオフセット (外周余白があるため範囲チェック不要)
+        const int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
+        const int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+        const int stride = occ.stride();
+        int offs[8];
+        for (int i = 0; i < 8; ++i) offs[i] = dy[i] * stride + dx[i];
+
+        const uint8_t* grid = occ.data();
 
         int iterations = 0;
         const int progressInterval = 1000;
@@ -80,9 +410,11 @@ namespace Pathfinding {
         float estimatedTotal = static_cast<float>(heuristic(s, g));
         if (estimatedTotal < 1.0f) estimatedTotal = 1.0f;
 
-        while (!openList.empty()) {
-            Node* curr = openList.top();
-            openList.pop();
+        while (!ctx.open.empty()) {
+            const int ci = ctx.open.pop();
+            ++ctx.stats.pops;
+            if ((ctx.stats.pops & (CancelCheckInterval - 1)) == 0 && ctx.cancelled()) return {};
+            const int currG = ctx.ws.g(ci);
 
             // 進捗通知
             if (progressCallback && (++iterations % progressInterval == 0)) {
@@ -90,74 +422,668 @@ namespace Pathfinding {
                 // もしくは G / limitCost
                 float p = 0.0f;
                 if (limitCost > 0) {
-                    p = static_cast<float>(curr->gCost) / static_cast<float>(limitCost);
+                    p = static_cast<float>(currG) / static_cast<float>(limitCost);
                 }
                 progressCallback(std::min(0.99f, p));
             }
 
-            if (curr->pos == g) {
+            if (ci == goalIdx) {
                 if (progressCallback) progressCallback(1.0f);
                 QList<QPoint> path;
-                Node* t = curr;
-                while (t != nullptr) {
-                    path.prepend(t->pos);
-                    t = t->parent;
+                for (int t = ci; t != -1; t = ctx.ws.parent(t)) {
+                    path.prepend(occ.pointAt(t));
                 }
                 return path;
             }
 
-            m_grid[curr->pos.y()][curr->pos.x()] = 2; // Closed
+            ctx.ws.close(ci);
+            ++ctx.stats.expansions;
+            const QPoint curr = occ.pointAt(ci);
 
             for (int i = 0; i < 8; ++i) {
-                QPoint next(curr->pos.x() + dx[i], curr->pos.y() + dy[i]);
-
-                if (next.x() < 0 || next.x() >= m_gridW || next.y() < 0 || next.y() >= m_gridH) continue;
-                if (m_grid[next.y()][next.x()] != 0) continue;
+                const int ni = ci + offs[i];
+                if (grid[ni] != 0 || ctx.ws.isClosed(ni)) continue;
 
                 if (i >= 4) {
-                    if (m_grid[curr->pos.y()][next.x()] != 0 || m_grid[next.y()][curr->pos.x()] != 0) continue;
+                    if (grid[ci + dx[i]] != 0 || grid[ci + dy[i] * stride] != 0) continue;
                 }
 
+                QPoint next(curr.x() + dx[i], curr.y() + dy[i]);
                 if (heuristic(s, next) + heuristic(next, g) > limitCost) continue;
 
-                Node* neighbor = &allNodes[next.y()][next.x()];
                 int moveCost = (i < 4) ? 10 : 15;
+                if (stepCost) moveCost += int(stepCost[ni]);
+
+                const int newG = currG + moveCost;
+                if (ctx.ws.isSeen(ni) && newG >= ctx.ws.g(ni)) continue;
+                relax(ctx, ni, newG, ci, heuristic(next, g));
+            }
+        }
+
+        return {};
+    }
+
+    QList<QPoint> Pathfinder::searchAnytime(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const
+    {
+        // ARA* (Anytime Repairing A*)
+        // キー g + ε·h の重み付き A* で解を求め、時間が残っていれば ε を下げて再探索する
+        // 再探索では前回の g を引き継ぎ、前回 Closed 後に g が下がったセル (INCONS) と Open だけから再開する
+        // 重み付きのキーは単調でないため、Open は Radix Heap ではなく古いエントリを読み飛ばす二分ヒープで持つ
+        const OccupancyGrid& occ = m_layers->grid;
+        ctx.ws.prepare(occ.size());
+        if (int(ctx.closedPass.size()) != occ.size()) {
+            ctx.closedPass.assign(size_t(occ.size()), 0);
+            ctx.pass = 0;
+        }
 
-                int penalty = 0;
-                if (m_cfg.mode == 0 && !m_distField.empty()) { // Safe mode
-                    int d = m_distField[next.y()][next.x()];
-                    int r = m_cfg.resolution;
-                    if (r <= 0) r = 10;
-                    const double d_mm = std::max(0, d) * double(r);
-                    const double w = 5e5;
-                    penalty = int(w / ((d_mm + 1.0) * (d_mm + 1.0)));
-                }
-
-                int attract = 0;
-                if (m_cfg.useWpField && !m_wpField.empty()) {
-                    int dist = m_wpField[next.y()][next.x()];
-                    if (dist > 0) {
-                        int r = m_cfg.resolution;
-                        if (r <= 0) r = 10;
-                        attract = dist * r;
+        QElapsedTimer clock;
+        clock.start();
+        const qint64 budgetMs = m_cfg.timeBudgetMs;
+
+        const int startIdx = occ.index(s);
+        const int goalIdx = occ.index(g);
+        const int limitCost = corridorLimit(s, g);
+
+        const int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
+        const int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+        const int stride = occ.stride();
+        int offs[8];
+        for (int i = 0; i < 8; ++i) offs[i] = dy[i] * stride + dx[i];
+        const uint8_t* grid = occ.data();
+
+        struct Entry {
+            int key;
+            int g; // 積んだ時の g (セルの g と異なれば古いエントリ)
+            int idx;
+            bool operator>(const Entry& o) const { return key > o.key; }
+        };
+        std::vector<Entry> open;
+        std::vector<int> incons;
+        auto h = [&](int idx) { return heuristic(occ.pointAt(idx), g); };
+
+        double eps = std::max(1.0, m_cfg.anytimeEpsilon);
+        auto keyOf = [&](int idx) { return ctx.ws.g(idx) + int(eps * h(idx)); };
+        auto push = [&](int idx) {
+            open.push_back({ keyOf(idx), ctx.ws.g(idx), idx });
+            std::push_heap(open.begin(), open.end(), std::greater<Entry>());
+            ++ctx.stats.pushes;
+        };
+
+        ctx.ws.open(startIdx, 0, -1);
+        push(startIdx);
+
+        // 1回分の探索。終点の g + ε·h が Open の最小キー以下になったら終える
+        // 2回目以降は deadline を過ぎたら打ち切り、false を返す (中止要求があった場合は1回目でも打ち切る)
+        auto improvePath = [&](bool interruptible) {
+            ++ctx.pass;
+            if (ctx.pass == 0) {
+                std::fill(ctx.closedPass.begin(), ctx.closedPass.end(), 0u);
+                ctx.pass = 1;
+            }
+            int iterations = 0;
+            while (!open.empty()) {
+                const Entry top = open.front();
+                if (ctx.ws.isSeen(goalIdx) && keyOf(goalIdx) <= top.key) return true;
+                std::pop_heap(open.begin(), open.end(), std::greater<Entry>());
+                open.pop_back();
+                ++ctx.stats.pops;
+                if ((ctx.stats.pops & (CancelCheckInterval - 1)) == 0 && ctx.cancelled()) return false;
+                if (top.g != ctx.ws.g(top.idx) || ctx.closedPass[size_t(top.idx)] == ctx.pass) continue;
+
+                if (interruptible && budgetMs > 0 && (++iterations & 1023) == 0 && clock.elapsed() >= budgetMs) return false;
+
+                const int ci = top.idx;
+                ctx.closedPass[size_t(ci)] = ctx.pass;
+                ++ctx.stats.expansions;
+                const QPoint curr = occ.pointAt(ci);
+                const int currG = ctx.ws.g(ci);
+
+                for (int i = 0; i < 8; ++i) {
+                    const int ni = ci + offs[i];
+                    if (grid[ni] != 0) continue;
+                    if (i >= 4 && (grid[ci + dx[i]] != 0 || grid[ci + dy[i] * stride] != 0)) continue;
+
+                    const QPoint next(curr.x() + dx[i], curr.y() + dy[i]);
+                    if (heuristic(s, next) + heuristic(next, g) > limitCost) continue;
+
+                    int moveCost = (i < 4) ? 10 : 15;
+                    if (stepCost) moveCost += int(stepCost[ni]);
+                    const int newG = currG + moveCost;
+                    if (ctx.ws.isSeen(ni) && newG >= ctx.ws.g(ni)) continue;
+
+                    ctx.ws.open(ni, newG, ci);
+                    // 今回既に Closed にしたセルは次回の再探索まで INCONS に置く
+                    if (ctx.closedPass[size_t(ni)] == ctx.pass) incons.push_back(ni);
+                    else push(ni);
+                }
+            }
+            return ctx.ws.isSeen(goalIdx);
+        };
+
+        // 最適値の下限は Open と INCONS の g + h の最小値
+        auto bound = [&]() {
+            int lower = INT32_MAX;
+            for (const Entry& e : open) {
+                if (e.g == ctx.ws.g(e.idx)) lower = std::min(lower, e.g + h(e.idx));
+            }
+            for (int idx : incons) lower = std::min(lower, ctx.ws.g(idx) + h(idx));
+            const double ratio = lower > 0 && lower != INT32_MAX ? double(ctx.ws.g(goalIdx)) / lower : 1.0;
+            return std::max(1.0, std::min(eps, ratio));
+        };
+
+        QList<QPoint> best;
+        if (!improvePath(false)) return {};
+        for (;;) {
+            best.clear();
+            for (int t = goalIdx; t != -1; t = ctx.ws.parent(t)) best.prepend(occ.pointAt(t));
+            ctx.stats.suboptimality = bound();
+
+            if (progressCallback) {
+                progressCallback(budgetMs > 0 ? std::min(0.99f, float(clock.elapsed()) / float(budgetMs)) : float(1.0 / ctx.stats.suboptimality));
+            }
+            if (ctx.stats.suboptimality <= 1.0 || (budgetMs > 0 && clock.elapsed() >= budgetMs)) break;
+
+            // ε を下げ、INCONS を Open に戻してキーを付け直す
+            eps = std::max(1.0, std::min(eps, ctx.stats.suboptimality) - AnytimeEpsilonStep);
+            std::vector<Entry> rebuilt;
+            rebuilt.reserve(open.size() + incons.size());
+            for (const Entry& e : open) {
+                if (e.g == ctx.ws.g(e.idx)) rebuilt.push_back({ keyOf(e.idx), e.g, e.idx });
+            }
+            for (int idx : incons) rebuilt.push_back({ keyOf(idx), ctx.ws.g(idx), idx });
+            incons.clear();
+            open.swap(rebuilt);
+            std::make_heap(open.begin(), open.end(), std::greater<Entry>());
+
+            if (!improvePath(true)) break;
+        }
+        if (ctx.cancelled()) return {};
+
+        if (progressCallback) progressCallback(1.0f);
+        return best;
+    }
+
+    QList<QPoint> Pathfinder::searchAnyAngle(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const
+    {
+        // Lazy Theta*
+        // 隣接セルへは「親の親から直接見通せる」と仮定して親の親を親にし、視線の確認はそのセルを
+        // 取り出す時まで遅らせる。見通せなければ確定済みの隣接セルのうち最も安いものを親にする
+        // 視線の確認で g が増えるため取り出すキーは単調にならない。Radix Heap ではなく二分ヒープを使い、
+        // キーを下げる代わりに積み直して、積んだ時の g が一致しないエントリは読み飛ばす
+        const OccupancyGrid& occ = m_layers->grid;
+        ctx.ws.prepare(occ.size());
+
+        struct Entry {
+            int key;
+            int g; // 積んだ時の g (セルの g と異なれば古いエントリ)
+            int idx;
+            bool operator>(const Entry& o) const { return key > o.key; }
+        };
+        std::vector<Entry> open;
+        auto push = [&](int idx, int newG, int parent, int h) {
+            ctx.ws.open(idx, newG, parent);
+            open.push_back({ newG + h, newG, idx });
+            std::push_heap(open.begin(), open.end(), std::greater<Entry>());
+            ++ctx.stats.pushes;
+        };
+
+        const int startIdx = occ.index(s);
+        const int goalIdx = occ.index(g);
+        push(startIdx, 0, -1, euclidCost(s, g));
+
+        const int limitCost = corridorLimit(s, g);
+
+        const int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
+        const int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+        const int stride = occ.stride();
+        int offs[8];
+        for (int i = 0; i < 8; ++i) offs[i] = dy[i] * stride + dx[i];
+        const uint8_t* grid = occ.data();
+
+        // 隣接セル間の移動 (角の通り抜け不可) のコスト。通れなければ -1
+        auto stepTo = [&](int from, int i) {
+            const int to = from + offs[i];
+            if (grid[to] != 0) return -1;
+            if (i >= 4 && (grid[from + dx[i]] != 0 || grid[from + dy[i] * stride] != 0)) return -1;
+            return ((i < 4) ? 10 : 14) + (stepCost ? int(stepCost[to]) : 0);
+        };
+
+        int iterations = 0;
+        const int progressInterval = 1000;
+
+        while (!open.empty()) {
+            const Entry top = open.front();
+            std::pop_heap(open.begin(), open.end(), std::greater<Entry>());
+            open.pop_back();
+            ++ctx.stats.pops;
+            if ((ctx.stats.pops & (CancelCheckInterval - 1)) == 0 && ctx.cancelled()) return {};
+            if (ctx.ws.isClosed(top.idx) || top.g != ctx.ws.g(top.idx)) continue;
+
+            const int ci = top.idx;
+
+            // 仮定した親からの視線を確認し、g を線分の実コストに合わせる
+            const int pi = ctx.ws.parent(ci);
+            if (pi != -1) {
+                const int c = lineCost(pi, ci, stepCost);
+                if (c >= 0) {
+                    ctx.ws.open(ci, ctx.ws.g(pi) + c, pi);
+                }
+                else {
+                    int bestG = INT32_MAX;
+                    int bestParent = -1;
+                    for (int i = 0; i < 8; ++i) {
+                        const int ni = ci - offs[i];
+                        if (!ctx.ws.isClosed(ni)) continue;
+                        const int step = stepTo(ni, i);
+                        if (step >= 0 && ctx.ws.g(ni) + step < bestG) {
+                            bestG = ctx.ws.g(ni) + step;
+                            bestParent = ni;
+                        }
                     }
+                    ctx.ws.open(ci, bestG, bestParent);
                 }
+            }
+            const int currG = ctx.ws.g(ci);
 
-                int newG = curr->gCost + moveCost + penalty + attract;
-                if (neighbor->parent == nullptr || newG < neighbor->gCost) {
-                    neighbor->gCost = newG;
-                    neighbor->hCost = heuristic(next, g);
-                    neighbor->parent = curr;
-                    neighbor->pos = next;
-                    openList.push(neighbor);
+            if (progressCallback && (++iterations % progressInterval == 0) && limitCost > 0) {
+                progressCallback(std::min(0.99f, static_cast<float>(currG) / static_cast<float>(limitCost)));
+            }
+
+            if (ci == goalIdx) {
+                if (progressCallback) progressCallback(1.0f);
+                QList<QPoint> path;
+                for (int t = ci; t != -1; t = ctx.ws.parent(t)) {
+                    path.prepend(occ.pointAt(t));
                 }
+                return path;
+            }
+
+            ctx.ws.close(ci);
+            ++ctx.stats.expansions;
+            const QPoint curr = occ.pointAt(ci);
+
+            // 親の親 (無ければ自分) を親と仮定する。線分 pp→ci で払った追加コストは pp→next でも払うと見なす
+            const int pp = (pi != -1) ? ctx.ws.parent(ci) : ci;
+            const QPoint ppPoint = occ.pointAt(pp);
+            const int paid = currG - ctx.ws.g(pp) - euclidCost(ppPoint, curr);
+
+            for (int i = 0; i < 8; ++i) {
+                const int ni = ci + offs[i];
+                if (ctx.ws.isClosed(ni) || stepTo(ci, i) < 0) continue;
+
+                const QPoint next(curr.x() + dx[i], curr.y() + dy[i]);
+                if (heuristic(s, next) + heuristic(next, g) > limitCost) continue;
+
+                const int newG = ctx.ws.g(pp) + euclidCost(ppPoint, next) + std::max(0, paid) + (stepCost ? int(stepCost[ni]) : 0);
+                if (ctx.ws.isSeen(ni) && newG >= ctx.ws.g(ni)) continue;
+                push(ni, newG, pp, euclidCost(next, g));
             }
         }
 
         return {};
     }
 
-    const std::vector<std::vector<int>>& Pathfinder::getGrid() const { return m_grid; }
+    QList<QPoint> Pathfinder::searchHierarchical(SearchContext& ctx, const QPoint& s, const QPoint& g) const
+    {
+        // 抽象グラフは prepareHierarchy() でレイヤーと一緒に用意しておく
+        const MapLayers& layers = *m_layers;
+        if (!layers.hierarchy || !layers.hierarchy->matches(layers.grid)) return {};
+        const uint32_t* penalty = layers.penalty.empty() ? nullptr : layers.penalty.data();
+        return layers.hierarchy->findPath(layers.grid, penalty, s, g, &ctx.stats.expansions);
+    }
+
+    bool Pathfinder::useHierarchical() const
+    {
+        // 抽象グラフ (HPA*) は準最適なため指定された場合だけ使う。誘導場の引き寄せはクラスタ間で扱えないため対象外
+        return !m_cfg.useWpField && m_cfg.algorithm == SearchAlgorithm::Hierarchical;
+    }
+
+    void Pathfinder::prepareHierarchy()
+    {
+        // 抽象グラフはレイヤーと一緒に保持し、障害物の差分更新では影響するクラスタだけ作り直す
+        MapLayers& layers = *m_layers;
+        if (!layers.hierarchy || !layers.hierarchy->matches(layers.grid)) {
+            const uint32_t* penalty = layers.penalty.empty() ? nullptr : layers.penalty.data();
+            layers.hierarchy = std::make_shared<HierarchicalGraph>();
+            layers.hierarchy->build(layers.grid, penalty);
+        }
+    }
+
+    QList<QPoint> Pathfinder::searchBidirectional(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const
+    {
+        // 双方向 A*
+        // 順方向 (s→g) と逆方向 (g→s) を別スレッドで探索し、両側が g を付けたセルで経路をつなぐ
+        // 逆方向の辺 v→u のコストは順方向の u→v と同じ (移動コスト + v の追加コスト)
+        // 各側のヒューリスティックは無矛盾なので、どちらかの側の最小 f が暫定最良コスト μ 以上になれば μ が最適
+        // 並列に動かせない環境では同期のコストが割に合わないため片方向の A* で探索する
+        if (QThreadPool::globalInstance()->maxThreadCount() < 2) {
+            return searchAStar(ctx, s, g, stepCost, progressCallback);
+        }
+
+        const OccupancyGrid& occ = m_layers->grid;
+        const uint8_t* grid = occ.data();
+        const int stride = occ.stride();
+        const int limitCost = corridorLimit(s, g);
+
+        const int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
+        const int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+        int offs[8];
+        for (int i = 0; i < 8; ++i) offs[i] = dy[i] * stride + dx[i];
+
+        // 作業領域の世代更新はスレッド起動前に済ませる (相手側の公開値を読むため)
+        ctx.ws.prepare(occ.size());
+        ctx.wsRev.prepare(occ.size());
+        ctx.open.reset(occ.size());
+        ctx.openRev.reset(occ.size());
+        ctx.published[0].prepare(occ.size());
+        ctx.published[1].prepare(occ.size());
+
+        // 暫定最良コスト μ と接続セルを1語にまとめて保持する
+        constexpr uint64_t NoMeeting = uint64_t(INT32_MAX) << 32;
+        std::atomic<uint64_t> best(NoMeeting);
+        std::atomic<bool> stop(false);
+        std::atomic<int> frontier[2] = { {0}, {0} };
+        SearchStats sideStats[2];
+
+        auto offerMeeting = [&](int cost, int idx) {
+            const uint64_t candidate = (uint64_t(uint32_t(cost)) << 32) | uint32_t(idx);
+            uint64_t current = best.load();
+            while (candidate < current && !best.compare_exchange_weak(current, candidate)) {
+            }
+        };
+
+        // 両側の始点はスレッド起動前に公開しておく (片側だけが先に走っても相手の始点で接続できる)
+        const int startIdx = occ.index(s);
+        const int goalIdx = occ.index(g);
+        ctx.ws.open(startIdx, 0, -1);
+        ctx.wsRev.open(goalIdx, 0, -1);
+        ctx.published[0].publish(startIdx, 0);
+        ctx.published[1].publish(goalIdx, 0);
+        ctx.open.push(startIdx, uint32_t(heuristic(s, g)));
+        ctx.openRev.push(goalIdx, uint32_t(heuristic(g, s)));
+        sideStats[0].pushes = sideStats[1].pushes = 1;
+        if (startIdx == goalIdx) offerMeeting(0, startIdx);
+
+        auto searchSide = [&](int side) {
+            SearchWorkspace& ws = side == 0 ? ctx.ws : ctx.wsRev;
+            RadixHeap& open = side == 0 ? ctx.open : ctx.openRev;
+            PublishedCosts& mine = ctx.published[side];
+            const PublishedCosts& other = ctx.published[1 - side];
+            const QPoint to = side == 0 ? g : s;
+            SearchStats& st = sideStats[side];
+
+            int iterations = 0;
+            while (!open.empty() && !stop.load(std::memory_order_relaxed)) {
+                const int ci = open.pop();
+                ++st.pops;
+                if ((st.pops & (CancelCheckInterval - 1)) == 0 && ctx.cancelled()) {
+                    stop.store(true);
+                    break;
+                }
+                const int currG = ws.g(ci);
+                const QPoint curr = occ.pointAt(ci);
+
+                if (currG + heuristic(curr, to) >= int(best.load() >> 32)) {
+                    stop.store(true);
+                    break;
+                }
+
+                // 相手側で確定済みのセルは展開しない (そこを通る経路は接続時の μ で評価済み)
+                int32_t og = 0;
+                bool otherClosed = false;
+                if (other.read(ci, og, otherClosed)) {
+                    offerMeeting(currG + og, ci);
+                    if (otherClosed) {
+                        ws.close(ci);
+                        continue;
+                    }
+                }
+
+                frontier[side].store(currG, std::memory_order_relaxed);
+                if (side == 0 && progressCallback && (++iterations % 1000 == 0) && limitCost > 0) {
+                    const float p = float(currG + frontier[1].load(std::memory_order_relaxed)) / float(limitCost);
+                    progressCallback(std::min(0.99f, p));
+                }
+
+                ws.close(ci);
+                mine.publish(ci, currG, true);
+                ++st.expansions;
+
+                for (int i = 0; i < 8; ++i) {
+                    const int ni = ci + offs[i];
+                    if (grid[ni] != 0 || ws.isClosed(ni)) continue;
+
+                    if (i >= 4) {
+                        if (grid[ci + dx[i]] != 0 || grid[ci + dy[i] * stride] != 0) continue;
+                    }
+
+                    QPoint next(curr.x() + dx[i], curr.y() + dy[i]);
+                    if (heuristic(s, next) + heuristic(next, g) > limitCost) continue;
+
+                    // 追加コストは順方向で進入する側のセルに掛かる
+                    int moveCost = (i < 4) ? 10 : 15;
+                    if (stepCost) moveCost += int(stepCost[side == 0 ? ni : ci]);
+
+                    const int newG = currG + moveCost;
+                    if (ws.isSeen(ni) && newG >= ws.g(ni)) continue;
+
+                    const bool inOpen = ws.isSeen(ni);
+                    ws.open(ni, newG, ci);
+                    const uint32_t key = uint32_t(newG + heuristic(next, to));
+                    if (inOpen) {
+                        open.decrease(ni, key);
+                        ++st.decreases;
+                    }
+                    else {
+                        open.push(ni, key);
+                        ++st.pushes;
+                    }
+
+                    // 公開してから相手側を読むことで、同じセルを同時に更新しても必ずどちらかが接続に気付く
+                    mine.publish(ni, newG);
+                    if (other.read(ni, og, otherClosed)) offerMeeting(newG + og, ni);
+                }
+            }
+            // 片側が探索し尽くした場合も相手側を止める (μ が無限大なら経路なし)
+            stop.store(true);
+        };
+
+        parallelFor(0, 2, searchSide);
+
+        for (const SearchStats& st : sideStats) {
+            ctx.stats.expansions += st.expansions;
+            ctx.stats.pushes += st.pushes;
+            ctx.stats.pops += st.pops;
+            ctx.stats.decreases += st.decreases;
+        }
+
+        const uint64_t result = best.load();
+        if (result == NoMeeting || ctx.cancelled()) return {};
+        if (progressCallback) progressCallback(1.0f);
+
+        // 接続セルから順方向の親をたどって始点へ、逆方向の親をたどって終点へ
+        const int meet = int(uint32_t(result));
+        QList<QPoint> path;
+        for (int t = meet; t != -1; t = ctx.ws.parent(t)) {
+            path.prepend(occ.pointAt(t));
+        }
+        for (int t = ctx.wsRev.parent(meet); t != -1; t = ctx.wsRev.parent(t)) {
+            path.append(occ.pointAt(t));
+        }
+        return path;
+    }
+
+    QList<QPoint> Pathfinder::searchJumpPoint(SearchContext& ctx, const QPoint& s, const QPoint& g, const std::function<void(float)>& progressCallback) const
+    {
+        // Jump Point Search (角の通り抜けを許さない版)
+        // 直線・斜めに進み続けて強制隣接を持つセル (ジャンプ点) だけを Open リストに積む
+        // 斜め移動は両側の直進セルが通行可能な場合のみ許すため、強制隣接は直進中にのみ生じる
+        const OccupancyGrid& occ = m_layers->grid;
+        const uint8_t* grid = occ.data();
+        const int limitCost = corridorLimit(s, g);
+
+        // 障害物でなく楕円コリドー内のセルのみ通行可とし、A* と同じ探索空間にする
+        // 外周余白は障害物なので、通行可能なセルの隣接を参照する限り範囲チェックは不要
+        auto walkable = [&](int x, int y) {
+            if (grid[occ.index(x, y)] != 0) return false;
+            const QPoint p(x, y);
+            return heuristic(s, p) + heuristic(p, g) <= limitCost;
+        };
+
+        // 直進方向のジャンプ。ジャンプ点のインデックスを返す (無ければ -1)
+        auto jumpStraight = [&](int x, int y, int dx, int dy) -> int {
+            for (;; x += dx, y += dy) {
+                if (!walkable(x, y)) return -1;
+                if (x == g.x() && y == g.y()) return occ.index(x, y);
+                if (dx != 0) {
+                    if ((walkable(x, y - 1) && !walkable(x - dx, y - 1)) ||
+                        (walkable(x, y + 1) && !walkable(x - dx, y + 1))) {
+                        return occ.index(x, y);
+                    }
+                }
+                else {
+                    if ((walkable(x - 1, y) && !walkable(x - 1, y - dy)) ||
+                        (walkable(x + 1, y) && !walkable(x + 1, y - dy))) {
+                        return occ.index(x, y);
+                    }
+                }
+            }
+        };
+
+        // 斜め方向のジャンプ。各セルで直進成分の先にジャンプ点があれば、そのセル自身がジャンプ点になる
+        auto jumpDiagonal = [&](int x, int y, int dx, int dy) -> int {
+            for (;; x += dx, y += dy) {
+                if (!walkable(x, y)) return -1;
+                if (x == g.x() && y == g.y()) return occ.index(x, y);
+                if (jumpStraight(x + dx, y, dx, 0) != -1 || jumpStraight(x, y + dy, 0, dy) != -1) {
+                    return occ.index(x, y);
+                }
+                if (!walkable(x + dx, y) || !walkable(x, y + dy)) return -1;
+            }
+        };
+
+        ctx.ws.prepare(occ.size());
+        ctx.open.reset(occ.size());
+
+        const int startIdx = occ.index(s);
+        const int goalIdx = occ.index(g);
+        ctx.ws.open(startIdx, 0, -1);
+
+        const int lowerBound = heuristic(s, g);
+        ctx.open.push(startIdx, uint32_t(lowerBound));
+        ++ctx.stats.pushes;
+
+        int iterations = 0;
+        const int progressInterval = 1000;
+
+        while (!ctx.open.empty()) {
+            const int ci = ctx.open.pop();
+            ++ctx.stats.pops;
+            if ((ctx.stats.pops & (JumpCancelCheckInterval - 1)) == 0 && ctx.cancelled()) return {};
+            const int currG = ctx.ws.g(ci);
+
+            if (progressCallback && (++iterations % progressInterval == 0) && limitCost > 0) {
+                progressCallback(std::min(0.99f, static_cast<float>(currG) / static_cast<float>(limitCost)));
+            }
+
+            if (ci == goalIdx) {
+                if (progressCallback) progressCallback(1.0f);
+                // ジャンプ点の間を直線・斜めの1セルずつに展開する
+                QList<QPoint> path;
+                QPoint next = occ.pointAt(ci);
+                path.prepend(next);
+                for (int t = ctx.ws.parent(ci); t != -1; t = ctx.ws.parent(t)) {
+                    const QPoint jp = occ.pointAt(t);
+                    const int sx = (jp.x() > next.x()) - (jp.x() < next.x());
+                    const int sy = (jp.y() > next.y()) - (jp.y() < next.y());
+                    while (next != jp) {
+                        next += QPoint(sx, sy);
+                        path.prepend(next);
+                    }
+                }
+                return path;
+            }
+
+            ctx.ws.close(ci);
+            ++ctx.stats.expansions;
+            const QPoint curr = occ.pointAt(ci);
+            const int x = curr.x();
+            const int y = curr.y();
+
+            // 探索方向の候補 (親からの進行方向で枝刈りする)
+            int dirs[8][2];
+            int n = 0;
+            auto add = [&](int ddx, int ddy) { dirs[n][0] = ddx; dirs[n][1] = ddy; ++n; };
+
+            const int pi = ctx.ws.parent(ci);
+            if (pi == -1) {
+                for (int ddy = -1; ddy <= 1; ++ddy) {
+                    for (int ddx = -1; ddx <= 1; ++ddx) {
+                        if (ddx == 0 && ddy == 0) continue;
+                        if (!walkable(x + ddx, y + ddy)) continue;
+                        if (ddx != 0 && ddy != 0 && (!walkable(x + ddx, y) || !walkable(x, y + ddy))) continue;
+                        add(ddx, ddy);
+                    }
+                }
+            }
+            else {
+                const QPoint pp = occ.pointAt(pi);
+                const int dx = (x > pp.x()) - (x < pp.x());
+                const int dy = (y > pp.y()) - (y < pp.y());
+                if (dx != 0 && dy != 0) {
+                    const bool vert = walkable(x, y + dy);
+                    const bool horz = walkable(x + dx, y);
+                    if (vert) add(0, dy);
+                    if (horz) add(dx, 0);
+                    if (vert && horz) add(dx, dy);
+                }
+                else if (dx != 0) {
+                    const bool next = walkable(x + dx, y);
+                    const bool down = walkable(x, y + 1);
+                    const bool up = walkable(x, y - 1);
+                    if (next) {
+                        add(dx, 0);
+                        if (down) add(dx, 1);
+                        if (up) add(dx, -1);
+                    }
+                    if (down) add(0, 1);
+                    if (up) add(0, -1);
+                }
+                else {
+                    const bool next = walkable(x, y + dy);
+                    const bool right = walkable(x + 1, y);
+                    const bool left = walkable(x - 1, y);
+                    if (next) {
+                        add(0, dy);
+                        if (right) add(1, dy);
+                        if (left) add(-1, dy);
+                    }
+                    if (right) add(1, 0);
+                    if (left) add(-1, 0);
+                }
+            }
+
+            for (int k = 0; k < n; ++k) {
+                const int ddx = dirs[k][0];
+                const int ddy = dirs[k][1];
+                const int ji = (ddx != 0 && ddy != 0) ? jumpDiagonal(x + ddx, y + ddy, ddx, ddy)
+                                                      : jumpStraight(x + ddx, y + ddy, ddx, ddy);
+                if (ji == -1 || ctx.ws.isClosed(ji)) continue;
+
+                // ジャンプ点までは直線か斜めのみ (直進 10, 斜め 15)
+                const QPoint jp = occ.pointAt(ji);
+                const int ax = std::abs(jp.x() - x);
+                const int ay = std::abs(jp.y() - y);
+                const int newG = currG + 10 * std::max(ax, ay) + 5 * std::min(ax, ay);
+                if (ctx.ws.isSeen(ji) && newG >= ctx.ws.g(ji)) continue;
+                relax(ctx, ji, newG, ci, heuristic(jp, g));
+            }
+        }
+
+        return {};
+    }
+
+    const OccupancyGrid& Pathfinder::getGrid() const { return m_layers->grid; }
 
     QList<QPoint> Pathfinder::smoothPathStringPulling(const QList<QPoint>& path)
     {
@@ -289,29 +1215,47 @@ namespace Pathfinding {
 
     bool Pathfinder::isGridCollisionFree(const QPoint& p1, const QPoint& p2) const
     {
+        // 1ビット版のグリッドで、Bresenham 直線を同じ行 (急な直線は列) に並ぶセルの区間ごとに語単位で調べる
+        // 両端がグリッド外なら false
+        return m_layers->bits.lineFree(p1, p2);
+    }
+
+    int Pathfinder::lineCost(int a, int b, const uint32_t* stepCost) const
+    {
+        // isGridCollisionFree と同じ Bresenham 走査で、通過セル (始点を除く) の追加コストを合計する
+        const OccupancyGrid& occ = m_layers->grid;
+        const QPoint p1 = occ.pointAt(a);
+        const QPoint p2 = occ.pointAt(b);
+        if (!stepCost) {
+            // 追加コストが無ければ通過セルを1つずつ読む必要は無い
+            return m_layers->bits.lineFree(p1, p2) ? euclidCost(p1, p2) : -1;
+        }
+
         int x1 = p1.x(), y1 = p1.y();
-        int x2 = p2.x(), y2 = p2.y();
-        int dx = std::abs(x2 - x1), dy = -std::abs(y2 - y1);
-        int sx = (x1 < x2) ? 1 : -1;
-        int sy = (y1 < y2) ? 1 : -1;
+        const int x2 = p2.x(), y2 = p2.y();
+        const int dx = std::abs(x2 - x1), dy = -std::abs(y2 - y1);
+        const int sx = (x1 < x2) ? 1 : -1;
+        const int sy = (y1 < y2) ? 1 : -1;
         int err = dx + dy;
 
+        const uint8_t* grid = occ.data();
+        const int stepY = sy * occ.stride();
+        int idx = a;
+        int cost = euclidCost(p1, p2);
+
         while (true) {
-            if (x1 < 0 || x1 >= m_gridW || y1 < 0 || y1 >= m_gridH || m_grid[y1][x1] == 1) {
-                return false;
-            }
+            if (grid[idx] != 0) return -1;
+            if (stepCost && idx != a) cost += int(stepCost[idx]);
             if (x1 == x2 && y1 == y2) break;
-            int e2 = 2 * err;
+            const int e2 = 2 * err;
             if (e2 >= dy) {
-                if (x1 == x2) break;
-                err += dy; x1 += sx;
+                err += dy; x1 += sx; idx += sx;
             }
             if (e2 <= dx) {
-                if (y1 == y2) break;
-                err += dx; y1 += sy;
+                err += dx; y1 += sy; idx += stepY;
             }
         }
-        return true;
+        return cost;
     }
 
     bool Pathfinder::isWorldPathCollisionFree(const QPointF& p1, const QPointF& p2) const
@@ -324,115 +1268,656 @@ namespace Pathfinding {
         );
     }
 
+    quint64 Pathfinder::layerKey() const
+    {
+        if (!m_cfg.orientedFootprint) return footprintKey();
+        KeyHasher h;
+        h.add(footprintKey());
+        h.add(headingIndex());
+        return h.value();
+    }
+
+    quint64 Pathfinder::footprintKey() const
+    {
+        KeyHasher h;
+        h.add(m_gridW);
+        h.add(m_gridH);
+        h.add(m_cfg.resolution);
+        h.add(m_cfg.robotW);
+        h.add(m_cfg.robotH);
+        h.add(m_cfg.edgeThresh);
+        h.add(m_cfg.mode);
+        if (m_cfg.mode == 0) {
+            h.add(m_cfg.safeThresh); // Aggressive では膨張量に影響しない
+        }
+        h.add(m_cfg.orientedFootprint);
+        if (m_cfg.orientedFootprint) {
+            h.add(m_cfg.headingCount);
+        }
+        h.add(int(m_cfg.obstacles.size()));
+        for (const QRectF& r : m_cfg.obstacles) {
+            h.add(r.x());
+            h.add(r.y());
+            h.add(r.width());
+            h.add(r.height());
+        }
+        return h.value();
+    }
+
+    quint64 Pathfinder::searchKey() const
+    {
+        KeyHasher h;
+        h.add(layerKey());
+        h.add(m_cfg.useWpField ? waypointFieldKey() : 0ull);
+        h.add(m_cfg.algorithm);
+        h.add(m_cfg.detourFact);
+        h.add(m_cfg.detourMargin);
+        h.add(m_cfg.anytimeEpsilon);
+        h.add(m_cfg.timeBudgetMs);
+        return h.value();
+    }
+
+    int Pathfinder::headingIndex() const
+    {
+        // 向き k は k * 180 / headingCount 度 (長方形は 180 度回転で同じ形)
+        const int count = std::max(1, m_cfg.headingCount);
+        if (m_headingOverride >= 0 && m_headingOverride < count) return m_headingOverride;
+        const int k = int(std::lround(m_cfg.robotAngle * count / 180.0)) % count;
+        return k < 0 ? k + count : k;
+    }
+
+    quint64 Pathfinder::waypointFieldKey() const
+    {
+        KeyHasher h;
+        h.add(m_gridW);
+        h.add(m_gridH);
+        h.add(m_cfg.resolution);
+        h.add(int(m_cfg.waypoints.size()));
+        for (const QPointF& wp : m_cfg.waypoints) {
+            h.add(wp.x());
+            h.add(wp.y());
+        }
+        return h.value();
+    }
+
     void Pathfinder::generateConfigurationSpace()
     {
+        const quint64 key = layerKey();
+
+        // 向きを選び直す探索の向きはキャッシュに入れず、専用のレイヤーを作り直して使う
+        // (キャッシュに入れると元の向きのレイヤーと、それに対応する区間ごとの探索状態が追い出される)
+        if (m_headingOverride >= 0) {
+            if (!m_headingLayers.second || m_headingLayers.first != key) {
+                // 他で使われていなければ確保済みの領域を使い回す
+                if (!m_headingLayers.second || m_headingLayers.second.use_count() > 1) {
+                    m_headingLayers.second = std::make_shared<MapLayers>();
+                }
+                buildConfigurationSpace(*m_headingLayers.second);
+                m_headingLayers.first = key;
+            }
+            m_layers = m_headingLayers.second;
+            return;
+        }
+
+        for (size_t i = 0; i < m_layerCache.size(); ++i) {
+            if (m_layerCache[i].first == key) {
+                m_layers = m_layerCache[i].second;
+                std::rotate(m_layerCache.begin(), m_layerCache.begin() + i, m_layerCache.begin() + i + 1);
+                return;
+            }
+        }
+
+        auto layers = std::make_shared<MapLayers>();
+        buildConfigurationSpace(*layers);
+
+        m_layers = layers;
+        m_layerCache.insert(m_layerCache.begin(), std::make_pair(key, layers));
+        if (int(m_layerCache.size()) > LayerCacheCapacity) {
+            m_layerCache.pop_back();
+        }
+    }
+
+    void Pathfinder::generateHeadingStack()
+    {
+        const quint64 key = footprintKey();
+        const int count = std::max(1, m_cfg.headingCount);
+        if (m_headingStack.key == key && int(m_headingStack.grids.size()) == count) return;
         if (m_gridW <= 0 || m_gridH <= 0) return;
-        m_grid.assign(m_gridH, std::vector<int>(m_gridW, 0));
 
-        int res = m_cfg.resolution;
-        if (res <= 0) return;
+        // 向きごとの膨張は互いに独立なので並列に生成する
+        m_headingStack.key = key;
+        m_headingStack.grids.assign(size_t(count), OccupancyGrid());
+        const QRect bounds(0, 0, m_gridW, m_gridH);
+        parallelFor(0, count, [&](int k) {
+            OccupancyGrid& grid = m_headingStack.grids[size_t(k)];
+            grid.assign(m_gridW, m_gridH, 0, GridPad, 1);
+            rasterizeRegion(grid, bounds, k);
+        });
+    }
+
+    bool Pathfinder::attachLayers()
+    {
+        // 差分更新は現在の設定 (変更前の障害物) で生成済みのレイヤーにだけ反映する
+        // 他の設定のレイヤーを書き換えないよう、キャッシュに無ければ次回の generateConfigurationSpace() で全体を生成する
+        // 向きを選び直した探索の後なら元の向きに戻す (選び直した向きのレイヤーはキャッシュの外にあり、差分更新しない)
+        m_headingOverride = -1;
+        const quint64 key = layerKey();
+        for (const auto& entry : m_layerCache) {
+            if (entry.first == key) {
+                m_layers = entry.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Pathfinder::insertObstacle(int idx, const QRectF& rect)
+    {
+        idx = qBound(0, idx, int(m_cfg.obstacles.size()));
+        const bool attached = attachLayers();
+        m_cfg.obstacles.insert(idx, rect);
+        if (attached) updateLayersRegion(inflatedCellRect(rect));
+    }
+
+    void Pathfinder::removeObstacle(int idx)
+    {
+        if (idx < 0 || idx >= m_cfg.obstacles.size()) return;
+        const bool attached = attachLayers();
+        const QRectF old = m_cfg.obstacles.at(idx);
+        m_cfg.obstacles.removeAt(idx);
+        if (attached) updateLayersRegion(inflatedCellRect(old));
+    }
 
-        qreal inflate = qMax(m_cfg.robotW, m_cfg.robotH) / 2.0;
+    void Pathfinder::moveObstacle(int idx, const QRectF& rect)
+    {
+        if (idx < 0 || idx >= m_cfg.obstacles.size()) return;
+        const bool attached = attachLayers();
+        const QRect oldCells = inflatedCellRect(m_cfg.obstacles.at(idx));
+        const QRect newCells = inflatedCellRect(rect);
+        m_cfg.obstacles[idx] = rect;
+        if (!attached) return;
+
+        // ドラッグ中の小さな移動は1領域にまとめ、離れた移動は2領域を個別に更新する
+        if (oldCells.intersects(newCells)) {
+            updateLayersRegion(oldCells.united(newCells));
+        }
+        else {
+            updateLayersRegion(oldCells);
+            updateLayersRegion(newCells);
+        }
+    }
+
+    void Pathfinder::updateObstacles(const QList<QRectF>& obstacles)
+    {
+        const QList<QRectF>& cur = m_cfg.obstacles;
+        const int n = int(cur.size());
+        const int m = int(obstacles.size());
+        if (m_layers && std::abs(n - m) <= 1) {
+            int first = 0;
+            while (first < std::min(n, m) && cur[first] == obstacles[first]) ++first;
+
+            if (m == n + 1 && std::equal(cur.begin() + first, cur.end(), obstacles.begin() + first + 1)) {
+                insertObstacle(first, obstacles[first]);
+                return;
+            }
+            if (m == n - 1 && std::equal(obstacles.begin() + first, obstacles.end(), cur.begin() + first + 1)) {
+                removeObstacle(first);
+                return;
+            }
+            if (m == n) {
+                std::vector<int> moved;
+                for (int i = first; i < n && moved.size() <= MaxIncrementalMoves; ++i) {
+                    if (cur[i] != obstacles[i]) moved.push_back(i);
+                }
+                if (moved.size() <= MaxIncrementalMoves) {
+                    for (int i : moved) moveObstacle(i, obstacles[i]);
+                    return;
+                }
+            }
+        }
+        // 差分が大きい場合は次回の generateConfigurationSpace() で全体を生成する
+        m_cfg.obstacles = obstacles;
+    }
+
+    qreal Pathfinder::inflation() const
+    {
+        // 向きを考慮する場合は、どの向きの外形も含む円の半径 (差分更新の範囲に使う)
+        qreal inflate = m_cfg.orientedFootprint
+            ? std::hypot(m_cfg.robotW, m_cfg.robotH) / 2.0
+            : qMax(m_cfg.robotW, m_cfg.robotH) / 2.0;
         if (m_cfg.mode == 0) { // Safe
             inflate *= m_cfg.safeThresh;
         }
+        if (m_cfg.orientedFootprint) {
+            // 外形を1セル長くした分・デジタル直線の丸め・障害物のセル境界への切り上げ
+            inflate += 5 * m_cfg.resolution;
+        }
+        return inflate;
+    }
 
-        for (const QRectF& r : m_cfg.obstacles) {
-            QRectF infR = r.adjusted(-inflate, -inflate, inflate, inflate);
-            int sx = qFloor(infR.left() / res);
-            int sy = qFloor(infR.top() / res);
-            int ex = qCeil(infR.right() / res);
-            int ey = qCeil(infR.bottom() / res);
+    QRect Pathfinder::inflatedCellRect(const QRectF& r) const
+    {
+        const int res = m_cfg.resolution;
+        if (res <= 0) return QRect();
+        const qreal inflate = inflation();
+        const QRectF infR = r.adjusted(-inflate, -inflate, inflate, inflate);
+        const QRect cells(QPoint(qFloor(infR.left() / res), qFloor(infR.top() / res)),
+            QPoint(qCeil(infR.right() / res) - 1, qCeil(infR.bottom() / res) - 1));
+        return cells.intersected(QRect(0, 0, m_gridW, m_gridH));
+    }
 
-            for (int y = sy; y < ey; ++y) {
-                if (y < 0 || y >= m_gridH) continue;
-                for (int x = sx; x < ex; ++x) {
-                    if (x < 0 || x >= m_gridW) continue;
-                    QPointF c((x + 0.5) * res, (y + 0.5) * res);
-                    if (infR.contains(c)) {
-                        m_grid[y][x] = 1;
-                    }
+    int Pathfinder::distanceCap() const
+    {
+        // これ以上離れると Safe モードのペナルティが 0 になる距離 (セル数)
+        const int res = m_cfg.resolution > 0 ? m_cfg.resolution : 10;
+        // 距離の2乗を float で誤差なく表せる範囲に収める
+        return qMin((SafePenaltyRangeMm + res - 1) / res, 4095);
+    }
+
+    void Pathfinder::updateLayersRegion(const QRect& cells)
+    {
+        // 未生成・サイズ不一致なら次回の generateConfigurationSpace() で全体を生成する
+        if (!m_layers || m_layers->grid.width() != m_gridW || m_layers->grid.height() != m_gridH || m_layers->grid.empty()) return;
+
+        // 他と共有中のレイヤーは複製してから書き換える
+        const MapLayers* previous = m_layers.get();
+        if (m_layers.use_count() > 2) {
+            auto copy = std::make_shared<MapLayers>(*m_layers);
+            if (copy->hierarchy) copy->hierarchy = std::make_shared<HierarchicalGraph>(*copy->hierarchy);
+            for (auto& entry : m_layerCache) {
+                if (entry.second == m_layers) entry.second = copy;
+            }
+            m_layers = copy;
+        }
+
+        if (!cells.isEmpty()) {
+            rasterizeRegion(m_layers->grid, cells, headingIndex());
+            m_layers->bits.update(m_layers->grid, cells);
+            QRect costRegion = cells;
+            if (!m_layers->penalty.empty()) {
+                updateDistanceRegion(*m_layers, cells);
+                // ペナルティは cap セル先まで変わる
+                const int cap = distanceCap();
+                costRegion = cells.adjusted(-cap, -cap, cap, cap);
+            }
+            if (m_layers->hierarchy) {
+                const uint32_t* penalty = m_layers->penalty.empty() ? nullptr : m_layers->penalty.data();
+                m_layers->hierarchy->update(m_layers->grid, penalty, costRegion);
+            }
+            for (auto& entry : m_segmentPlanners) {
+                if (entry.second.layers.lock().get() != previous) continue;
+                entry.second.planner.invalidate(costRegion);
+                entry.second.layers = m_layers;
+                entry.second.edited = true;
+            }
+        }
+
+        // 障害物リストが変わったのでキャッシュキーを付け替える
+        const quint64 key = layerKey();
+        m_layerCache.erase(std::remove_if(m_layerCache.begin(), m_layerCache.end(),
+            [&](const std::pair<quint64, std::shared_ptr<MapLayers>>& e) { return e.first == key && e.second != m_layers; }),
+            m_layerCache.end());
+        bool found = false;
+        for (auto& entry : m_layerCache) {
+            if (entry.second == m_layers) {
+                entry.first = key;
+                found = true;
+            }
+        }
+        // 向きを選び直す探索のレイヤーはキャッシュに入れない (generateConfigurationSpace() と同じ)
+        if (!found && m_headingOverride < 0) {
+            m_layerCache.insert(m_layerCache.begin(), std::make_pair(key, m_layers));
+            if (int(m_layerCache.size()) > LayerCacheCapacity) {
+                m_layerCache.pop_back();
+            }
+        }
+    }
+
+    void Pathfinder::buildConfigurationSpace(MapLayers& layers) const
+    {
+        if (m_gridW <= 0 || m_gridH <= 0) return;
+        layers.grid.assign(m_gridW, m_gridH, 0, GridPad, 1);
+        layers.penalty.clear();
+        layers.hierarchy.reset();
+
+        // 全ての向きを生成済みならその向きの占有グリッドを複製する
+        if (m_cfg.orientedFootprint && m_headingStack.key == footprintKey()
+            && size_t(headingIndex()) < m_headingStack.grids.size()) {
+            layers.grid = m_headingStack.grids[size_t(headingIndex())];
+        }
+        else {
+            rasterizeRegion(layers.grid, QRect(0, 0, m_gridW, m_gridH), headingIndex());
+        }
+        layers.bits.build(layers.grid);
+    }
+
+    void Pathfinder::rasterizeRegion(OccupancyGrid& grid, const QRect& region, int heading) const
+    {
+        const int res = m_cfg.resolution;
+        const QRect target = region.intersected(QRect(0, 0, m_gridW, m_gridH));
+        if (res <= 0 || target.isEmpty()) return;
+
+        // タイルごとの生成は窓を膨張量だけ広げるため、その重複が大きくならないよう膨張量に比べて十分大きなタイルにする
+        const int size = std::max(RasterTileSize, 4 * qCeil(inflation() / res));
+        const int cols = (target.width() + size - 1) / size;
+        const int rows = (target.height() + size - 1) / size;
+
+        // 障害物を膨張後の範囲が掛かるタイルに振り分ける (範囲外の障害物はタイルのセルに影響しない)
+        std::vector<std::vector<int>> buckets(size_t(cols) * size_t(rows));
+        for (int i = 0; i < m_cfg.obstacles.size(); ++i) {
+            const QRect cells = inflatedCellRect(m_cfg.obstacles.at(i)).intersected(target);
+            if (cells.isEmpty()) continue;
+            for (int ty = (cells.top() - target.top()) / size; ty <= (cells.bottom() - target.top()) / size; ++ty) {
+                for (int tx = (cells.left() - target.left()) / size; tx <= (cells.right() - target.left()) / size; ++tx) {
+                    buckets[size_t(ty) * cols + tx].push_back(i);
+                }
+            }
+        }
+
+        // タイルは互いに別のセルだけを書き換えるため並列に生成できる
+        parallelFor(0, cols * rows, [&](int t) {
+            const int tx = t % cols;
+            const int ty = t / cols;
+            const QRect tile = QRect(target.left() + tx * size, target.top() + ty * size, size, size).intersected(target);
+            if (m_cfg.orientedFootprint) {
+                rasterizeOrientedTile(grid, tile, heading, buckets[size_t(t)]);
+            }
+            else {
+                rasterizeTile(grid, tile, buckets[size_t(t)]);
+            }
+        });
+    }
+
+    void Pathfinder::rasterizeTile(OccupancyGrid& grid, const QRect& region, const std::vector<int>& obstacles) const
+    {
+        const int res = m_cfg.resolution;
+
+        // 膨張後の矩形ごとに、中心が含まれるセルの範囲を求める
+        const qreal inflate = inflation();
+        std::vector<QRect> cells;
+        cells.reserve(obstacles.size());
+        qint64 fillArea = 0;
+        for (int i : obstacles) {
+            const QRectF& r = m_cfg.obstacles.at(i);
+            const QRectF infR = r.adjusted(-inflate, -inflate, inflate, inflate);
+            if (infR.width() <= 0 || infR.height() <= 0) continue;
+
+            int sx, ex, sy, ey;
+            cellCentersWithin(infR.left(), infR.right(), res, sx, ex);
+            cellCentersWithin(infR.top(), infR.bottom(), res, sy, ey);
+            const QRect c(QPoint(sx, sy), QPoint(ex, ey));
+            const QRect clipped = c.intersected(region);
+            if (clipped.isEmpty()) continue;
+            cells.push_back(c);
+            fillArea += qint64(clipped.width()) * clipped.height();
+        }
+
+        // 膨張量の整数セル分を k とすると、各範囲は各軸 2k セル以上の幅があるため
+        // 両端から radius = k - 1 セルずつ縮めても空にならず、それを radius セル膨張すると元の範囲に戻る
+        const int radius = std::max(0, qFloor(inflate / res) - 1);
+        const QRect window = region.adjusted(-radius, -radius, radius, radius);
+        const qint64 windowArea = qint64(window.width()) * window.height();
+
+        // 膨張後の範囲が大きく重なるときは、縮めた範囲を描いてから長方形の最大値フィルタでまとめて膨張する
+        // (手間は窓の面積だけで決まり、障害物の数・膨張量に依らない)
+        // 行の塗りつぶしは連続書き込みで十分速いため、塗る面積が窓の 32 倍程度までは範囲をそのまま塗る方が速い
+        if (radius == 0 || fillArea <= 32 * windowArea) {
+            for (int y = region.top(); y <= region.bottom(); ++y) {
+                uint8_t* row = &grid.at(0, y);
+                std::fill(row + region.left(), row + region.right() + 1, uint8_t(0));
+            }
+            for (const QRect& c : cells) {
+                const QRect clipped = c.intersected(region);
+                for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+                    uint8_t* row = &grid.at(0, y);
+                    std::fill(row + clipped.left(), row + clipped.right() + 1, uint8_t(1));
                 }
             }
         }
+        else {
+            // 領域のセルは radius 以内の描画結果だけで決まる。マップ外の障害物もマップ内に膨張するため窓はマップで切らない
+            const int ww = window.width();
+            const int wh = window.height();
+            std::vector<uint8_t> occupied(size_t(ww) * size_t(wh), 0);
+            for (const QRect& c : cells) {
+                const QRect shrunk = c.adjusted(radius, radius, -radius, -radius).intersected(window);
+                for (int y = shrunk.top(); y <= shrunk.bottom(); ++y) {
+                    uint8_t* row = &occupied[size_t(y - window.top()) * ww];
+                    std::fill(row + (shrunk.left() - window.left()), row + (shrunk.right() - window.left()) + 1, uint8_t(1));
+                }
+            }
+
+            std::vector<uint8_t> tmp;
+            Morphology::dilateRect(occupied.data(), ww, occupied.data(), ww, ww, wh, radius, radius, tmp);
+
+            for (int y = region.top(); y <= region.bottom(); ++y) {
+                const uint8_t* src = &occupied[size_t(y - window.top()) * ww + (region.left() - window.left())];
+                std::copy(src, src + region.width(), &grid.at(region.left(), y));
+            }
+        }
+
+        applyEdgeMargin(grid, region);
+    }
+
+    void Pathfinder::rasterizeOrientedTile(OccupancyGrid& grid, const QRect& region, int heading, const std::vector<int>& obstacles) const
+    {
+        const int res = m_cfg.resolution;
+
+        // 外形の寸法 (セル)。デジタル直線で近似した線分は最大1セル短くなるため、1セル長くして取りこぼしを防ぐ
+        const double scale = (m_cfg.mode == 0) ? m_cfg.safeThresh : 1.0;
+        const double fw = m_cfg.robotW * scale / res + 1.0;
+        const double fh = m_cfg.robotH * scale / res + 1.0;
+        const double angle = qDegreesToRadians(heading * 180.0 / std::max(1, m_cfg.headingCount));
+
+        // 領域のセルに掛かる障害物セルは外形の (幅 + 高さ) / 2 以内にある
+        // 2回の線分膨張の途中結果も窓に収まるよう、マップ外も含めてその分広げた窓で膨張する
+        const int reach = int(std::ceil((fw + fh) / 2.0)) + 1;
+        const QRect window = region.adjusted(-reach, -reach, reach, reach);
+        const int ww = window.width();
+        const int wh = window.height();
+
+        // 障害物と重なるセルを描いてから外形で膨張する
+        std::vector<uint8_t> occupied(size_t(ww) * size_t(wh), 0);
+        for (int i : obstacles) {
+            const QRectF& r = m_cfg.obstacles.at(i);
+            const int sx = qMax(window.left(), qFloor(r.left() / res));
+            const int sy = qMax(window.top(), qFloor(r.top() / res));
+            const int ex = qMin(window.right() + 1, qCeil(r.right() / res));
+            const int ey = qMin(window.bottom() + 1, qCeil(r.bottom() / res));
+            if (sx >= ex) continue;
+            for (int y = sy; y < ey; ++y) {
+                uint8_t* row = &occupied[size_t(y - window.top()) * ww];
+                std::fill(row + (sx - window.left()), row + (ex - window.left()), uint8_t(1));
+            }
+        }
+
+        std::vector<uint8_t> dilated(occupied.size());
+        std::vector<uint8_t> tmp;
+        Morphology::dilateRotatedRect(occupied.data(), ww, dilated.data(), ww, ww, wh, angle, fw, fh, tmp,
+            window.left(), window.top());
+
+        for (int y = region.top(); y <= region.bottom(); ++y) {
+            const uint8_t* src = &dilated[size_t(y - window.top()) * ww + (region.left() - window.left())];
+            std::copy(src, src + region.width(), &grid.at(region.left(), y));
+        }
+
+        applyEdgeMargin(grid, region);
+    }
 
-        if (m_cfg.edgeThresh > 0) {
+    void Pathfinder::applyEdgeMargin(OccupancyGrid& grid, const QRect& region) const
+    {
+        const int res = m_cfg.resolution;
+        if (m_cfg.edgeThresh > 0 && res > 0) {
             int edge = qCeil(m_cfg.edgeThresh / res);
             if (edge > 0) {
-                for (int y = 0; y < m_gridH; ++y) {
-                    for (int x = 0; x < m_gridW; ++x) {
-                        if (x < edge || x >= m_gridW - edge || y < edge || y >= m_gridH - edge) {
-                            m_grid[y][x] = 1;
-                        }
+                // 上下の帯は行全体、それ以外の行は左右の帯だけを塗る
+                const int left = std::min(region.right(), edge - 1);
+                const int right = std::max(region.left(), m_gridW - edge);
+                for (int y = region.top(); y <= region.bottom(); ++y) {
+                    uint8_t* row = &grid.at(0, y);
+                    if (y < edge || y >= m_gridH - edge) {
+                        std::fill(row + region.left(), row + region.right() + 1, uint8_t(1));
+                        continue;
                     }
+                    if (region.left() <= left) std::fill(row + region.left(), row + left + 1, uint8_t(1));
+                    if (right <= region.right()) std::fill(row + right, row + region.right() + 1, uint8_t(1));
                 }
             }
         }
     }
 
-    void Pathfinder::generateDistanceField()
+    void Pathfinder::buildDistanceField(MapLayers& layers) const
     {
         if (m_gridW <= 0 || m_gridH <= 0) return;
-        m_distField.assign(m_gridH, std::vector<int>(m_gridW, -1));
-        std::queue<QPoint> q;
-        int res = m_cfg.resolution;
-        if (res <= 0) return;
+        // 余白は 0 のまま (参照されない)
+        layers.penalty.assign(m_gridW, m_gridH, 0, GridPad, 0);
+        updateDistanceRegion(layers, QRect(0, 0, m_gridW, m_gridH));
+    }
 
-        for (int y = 0; y < m_gridH; ++y) {
-            for (int x = 0; x < m_gridW; ++x) {
-                if (m_grid[y][x] == 1) { // 障害物
-                    q.push(QPoint(x, y));
-                    m_distField[y][x] = 0;
+    void Pathfinder::updateDistanceRegion(MapLayers& layers, const QRect& region) const
+    {
+        const OccupancyGrid& grid = layers.grid;
+        // 距離は distanceCap() で打ち切るため、占有が変わった region の影響は cap セル先までに限られる
+        // 影響範囲 (region + cap) の値は、さらに cap 広げた窓内の障害物だけで決まるので、
+        // 窓内で距離変換を行い影響範囲のみ書き戻す
+        const int cap = distanceCap();
+        const float cap2 = float(cap) * float(cap);
+        const double res = m_cfg.resolution > 0 ? m_cfg.resolution : 10;
+        const QRect bounds(0, 0, m_gridW, m_gridH);
+        const QRect affected = region.adjusted(-cap, -cap, cap, cap).intersected(bounds);
+        const QRect window = affected.adjusted(-cap, -cap, cap, cap).intersected(bounds);
+        const int ww = window.width();
+        const int wh = window.height();
+        if (ww <= 0 || wh <= 0) return;
+
+        // 列方向: 同じ列で最も近い障害物までの距離の2乗
+        // 行を順に走査して列ごとの直近の障害物を追跡する (列ブロック単位で並列化)
+        // cap 以上離れた標本は最終結果に寄与しないため無限大として包絡計算から除外する
+        std::vector<float> local(size_t(ww) * size_t(wh));
+        const int block = 64;
+        parallelFor(0, (ww + block - 1) / block, [&](int b) {
+            const int x0 = b * block;
+            const int x1 = std::min(ww, x0 + block);
+            int last[block];
+            std::fill(last, last + block, -1);
+            for (int y = 0; y < wh; ++y) {
+                const uint8_t* row = &grid.at(window.left(), window.top() + y);
+                float* out = &local[size_t(y) * ww];
+                for (int x = x0; x < x1; ++x) {
+                    if (row[x] == 1) last[x - x0] = y;
+                    out[x] = (last[x - x0] < 0 || y - last[x - x0] >= cap) ? EdtInfinity : float(y - last[x - x0]);
                 }
             }
-        }
-
-        int dx[] = { 0, 0, 1, -1 };
-        int dy[] = { 1, -1, 0, 0 };
-
-        while (!q.empty()) {
-            QPoint p = q.front(); q.pop();
-            for (int i = 0; i < 4; ++i) {
-                int nx = p.x() + dx[i];
-                int ny = p.y() + dy[i];
-                if (nx >= 0 && nx < m_gridW && ny >= 0 && ny < m_gridH && m_distField[ny][nx] == -1) {
-                    m_distField[ny][nx] = m_distField[p.y()][p.x()] + 1;
-                    q.push(QPoint(nx, ny));
+            std::fill(last, last + block, -1);
+            for (int y = wh - 1; y >= 0; --y) {
+                const uint8_t* row = &grid.at(window.left(), window.top() + y);
+                float* out = &local[size_t(y) * ww];
+                for (int x = x0; x < x1; ++x) {
+                    if (row[x] == 1) last[x - x0] = y;
+                    if (last[x - x0] >= 0 && float(last[x - x0] - y) < out[x]) out[x] = float(last[x - x0] - y);
+                    out[x] *= out[x];
                 }
             }
-        }
+        });
+
+        // 行方向: 列方向の結果に対する下側包絡放物線で厳密なユークリッド距離を得て、影響範囲のペナルティに変換する
+        parallelFor(affected.top(), affected.bottom() + 1, [&](int y) {
+            thread_local std::vector<float> d;
+            thread_local std::vector<int> v;
+            thread_local std::vector<double> z;
+            d.resize(size_t(ww));
+            v.resize(size_t(ww));
+            z.resize(size_t(ww));
+            squaredDistance1D(&local[size_t(y - window.top()) * ww], d.data(), ww, v.data(), z.data());
+            uint32_t* penalty = &layers.penalty.at(affected.left(), y);
+            const float* src = &d[size_t(affected.left() - window.left())];
+            for (int x = 0; x < affected.width(); ++x) {
+                // 障害物から離れるほど小さくなるペナルティ (SafePenaltyRangeMm 以上で 0)
+                const double d_mm = std::sqrt(double(std::min(src[x], cap2))) * res;
+                penalty[x] = uint32_t(5e5 / ((d_mm + 1.0) * (d_mm + 1.0)));
+            }
+        }, 16);
     }
 
     void Pathfinder::generateWaypointField() {
         if (m_gridW <= 0 || m_gridH <= 0) return;
 
-        m_wpField.assign(m_gridH, std::vector<int>(m_gridW, -1));
-        std::queue<QPoint> q;
+        const quint64 key = waypointFieldKey();
+        if (key == m_wpKey && !m_wpField.empty()) return;
+        m_wpKey = key;
+
+        m_wpField.assign(m_gridW, m_gridH, 0, GridPad, 0);
         int res = m_cfg.resolution;
         if (res <= 0) return;
 
+        // 最寄りのウェイポイントまでの格子距離 (4近傍BFS)
+        DistanceGrid dist;
+        dist.assign(m_gridW, m_gridH, DistanceUnreached, GridPad, 0);
+        std::queue<int> q;
+
         for (const QPointF& wp : m_cfg.waypoints) {
             QPoint p(qFloor(wp.x() / res), qFloor(wp.y() / res));
-            if (p.x() >= 0 && p.x() < m_gridW && p.y() >= 0 && p.y() < m_gridH && m_wpField[p.y()][p.x()] == -1) {
-                m_wpField[p.y()][p.x()] = 0;
-                q.push(p);
+            if (dist.contains(p) && dist.at(p.x(), p.y()) == DistanceUnreached) {
+                const int idx = dist.index(p);
+                dist[idx] = 0;
+                q.push(idx);
             }
         }
 
-        int dx[] = { 0, 0, 1, -1 };
-        int dy[] = { 1, -1, 0, 0 };
+        const int stride = dist.stride();
+        const int offs[] = { stride, -stride, 1, -1 };
 
         while (!q.empty()) {
-            QPoint p = q.front(); q.pop();
+            const int p = q.front(); q.pop();
+            const uint16_t next = uint16_t(qMin(int(dist[p]) + 1, DistanceUnreached - 1));
             for (int i = 0; i < 4; ++i) {
-                int nx = p.x() + dx[i];
-                int ny = p.y() + dy[i];
-                if (nx >= 0 && nx < m_gridW && ny >= 0 && ny < m_gridH && m_wpField[ny][nx] == -1) {
-                    m_wpField[ny][nx] = m_wpField[p.y()][p.x()] + 1;
-                    q.push(QPoint(nx, ny));
+                const int n = p + offs[i];
+                if (dist[n] == DistanceUnreached) {
+                    dist[n] = next;
+                    q.push(n);
                 }
             }
         }
+
+        // 引き寄せコスト (距離 x 解像度。ウェイポイント上と未到達は 0)
+        for (int y = 0; y < m_gridH; ++y) {
+            const uint16_t* src = &dist.at(0, y);
+            uint32_t* dst = &m_wpField.at(0, y);
+            for (int x = 0; x < m_gridW; ++x) {
+                dst[x] = src[x] == DistanceUnreached ? 0u : uint32_t(src[x]) * uint32_t(res);
+            }
+        }
+    }
+
+    const uint32_t* Pathfinder::stepCostLayer() const
+    {
+        const bool safe = m_cfg.mode == 0 && !m_layers->penalty.empty();
+        const bool attract = m_cfg.useWpField && !m_wpField.empty();
+        if (!safe) return attract ? m_wpField.data() : nullptr;
+        if (!attract) return m_layers->penalty.data();
+        return m_stepCost.data();
+    }
+
+    void Pathfinder::prepareStepCost()
+    {
+        const bool safe = m_cfg.mode == 0 && !m_layers->penalty.empty();
+        const bool attract = m_cfg.useWpField && !m_wpField.empty();
+        if (!safe || !attract) return;
+
+        // 両方使う場合は合算したレイヤーを生成 (レイヤーとウェイポイントが変わらなければ再利用)
+        KeyHasher h;
+        h.add(layerKey());
+        h.add(m_wpKey);
+        if (h.value() != m_stepCostKey || m_stepCost.size() != m_wpField.size()) {
+            m_stepCostKey = h.value();
+            m_stepCost.assign(m_gridW, m_gridH, 0, GridPad, 0);
+            const uint32_t* penalty = m_layers->penalty.data();
+            const uint32_t* wp = m_wpField.data();
+            uint32_t* out = m_stepCost.data();
+            for (int i = 0; i < m_stepCost.size(); ++i) {
+                out[i] = penalty[i] + wp[i];
+            }
+        }
     }
 
     int Pathfinder::heuristic(const QPoint& a, const QPoint& b) const
@@ -442,39 +1927,45 @@ namespace Pathfinding {
         return 10 * (dx + dy) + (14 - 2 * 10) * std::min(dx, dy);
     }
 
+    int Pathfinder::euclidCost(const QPoint& a, const QPoint& b) const
+    {
+        const int dx = a.x() - b.x();
+        const int dy = a.y() - b.y();
+        return int(10.0 * std::sqrt(double(dx * dx + dy * dy)));
+    }
+
     bool Pathfinder::isGridPassable(const QPoint& p) const
     {
-        if (p.x() < 0 || p.x() >= m_gridW || p.y() < 0 || p.y() >= m_gridH) return false;
-        return m_grid[p.y()][p.x()] == 0;
+        const OccupancyGrid& occ = m_layers->grid;
+        if (!occ.contains(p)) return false;
+        return occ.at(p.x(), p.y()) == 0;
     }
 
     QPoint Pathfinder::findNearestPassable(const QPoint& p) const
     {
         if (isGridPassable(p)) return p;
+        const OccupancyGrid& occ = m_layers->grid;
+        if (!occ.contains(p)) return QPoint(-1, -1);
 
-        std::queue<QPoint> q;
-        std::vector<std::vector<bool>> visited(m_gridH, std::vector<bool>(m_gridW, false));
+        // 訪問済みは探索した付近のタイルだけを確保する (マップ全体の配列は確保しない)
+        TiledGrid<uint8_t> visited;
+        visited.assign(m_gridW, m_gridH, 0);
 
-        if (p.x() >= 0 && p.x() < m_gridW && p.y() >= 0 && p.y() < m_gridH) {
-            q.push(p);
-            visited[p.y()][p.x()] = true;
-        }
-        else {
-            return QPoint(-1, -1);
-        }
+        std::queue<QPoint> q;
+        q.push(p);
+        visited.set(p.x(), p.y(), 1);
 
-        int dx[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
-        int dy[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+        const QPoint offs[] = { QPoint(0, 1), QPoint(0, -1), QPoint(1, 0), QPoint(-1, 0),
+            QPoint(1, 1), QPoint(1, -1), QPoint(-1, 1), QPoint(-1, -1) };
 
         while (!q.empty()) {
-            QPoint curr = q.front(); q.pop();
-            for (int i = 0; i < 8; ++i) {
-                QPoint next(curr.x() + dx[i], curr.y() + dy[i]);
-                if (next.x() >= 0 && next.x() < m_gridW && next.y() >= 0 && next.y() < m_gridH && !visited[next.y()][next.x()]) {
-                    if (isGridPassable(next)) return next;
-                    visited[next.y()][next.x()] = true;
-                    q.push(next);
-                }
+            const QPoint curr = q.front(); q.pop();
+            for (const QPoint& d : offs) {
+                const QPoint next = curr + d;
+                if (!visited.contains(next) || visited.at(next.x(), next.y())) continue;
+                if (occ.at(next.x(), next.y()) == 0) return next;
+                visited.set(next.x(), next.y(), 1);
+                q.push(next);
             }
         }
         return QPoint(-1, -1);
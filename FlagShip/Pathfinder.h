@@ -6,10 +6,38 @@
 #include <QList>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <utility>
+#include <map>
+#include <atomic>
+#include <QMutex>
 #include <QRectF>
+#include <QRect>
+#include "Grid.h"
+#include "BitGrid.h"
+#include "SearchWorkspace.h"
+#include "RadixHeap.h"
+#include "HierarchicalGraph.h"
+#include "DStarLite.h"
+#include "VisibilityGraph.h"
 
 namespace Pathfinding {
 
+    // 探索の中止要求。呼び出し側が true にすると、実行中の探索は展開ループ内で気付いて空の経路を返す
+    using CancelToken = std::shared_ptr<std::atomic<bool>>;
+
+    // 探索アルゴリズム
+    enum class SearchAlgorithm {
+        Auto,          // 一様コストなら JumpPoint、それ以外は Bidirectional (findPathShared() では AStar)
+        AStar,
+        JumpPoint,     // 一様コストでのみ有効。追加コストがある場合は AStar で探索する
+        Bidirectional, // 始点・終点の両側から2スレッドで探索する A* (長距離の1区間向け)
+        Hierarchical,  // クラスタ分割した抽象グラフで探索してから詳細化する (HPA*)。最適解ではなく迂回範囲の制限もない
+                       // 準最適な経路で良い場合だけ指定する (Auto では選ばない)。誘導場を使う場合は AStar
+        AnyAngle,      // Lazy Theta*。視線の通る折れ点だけの経路を返す (隣り合うセルの列ではない)
+        Anytime        // ARA*。重み付き A* で素早く解を求め、timeBudgetMs の間 ε を下げながら改善する
+    };
+
     // 経路探索に必要なデータをまとめた構造体
     struct PathfinderConfig {
         int mapW;
@@ -29,24 +57,73 @@ namespace Pathfinding {
         bool useWpField;
         double detourFact = 1.6;
         int detourMargin = 8;
+        SearchAlgorithm algorithm = SearchAlgorithm::Auto;
+
+        // Anytime 用: 最初の解のヒューリスティックの重み ε と、解を改善し続ける時間 (ms, 0 なら最適解まで)
+        double anytimeEpsilon = 2.0;
+        int timeBudgetMs = 0;
+
+        // 向きを考慮した C-Space: 障害物をロボットの外形 (robotW x robotH の長方形を robotAngle 回転したもの) で膨張する
+        // false なら向きに依らず長辺の半分で膨張する。headingCount は 180 度の分割数 (長方形は 180 度回転で同じ形)
+        bool orientedFootprint = false;
+        float robotAngle = 0.0f; // 度 (robotW の辺が x 軸となす角)
+        int headingCount = 16;
+        // orientedFootprint で経路が見つからない場合、robotAngle に近い向きから順に他の向きの C-Space で探索し直す
+        bool pickHeading = true;
+    };
+
+    // 外周余白 (障害物扱い) のセル数。8近傍の参照で範囲チェックを不要にする
+    constexpr int GridPad = 1;
+
+    // Safe モードのペナルティが 0 になる障害物からの距離 (mm)
+    constexpr int SafePenaltyRangeMm = 707;
+
+    // C-Space と安全距離場をまとめたレイヤー
+    // 全レイヤーは同じ寸法・余白 (GridPad) で確保し、インデックスを共有する
+    struct MapLayers {
+        OccupancyGrid grid;     // 0:通行可, 1:障害物
+        BitGrid bits;           // grid の1ビット版 (視線判定用。grid と同時に更新)
+        CostGrid penalty;       // Safe モードの探索時に生成 (障害物までの距離から求めるペナルティ。SafePenaltyRangeMm 以上で 0)
+        std::shared_ptr<HierarchicalGraph> hierarchy; // Hierarchical 探索時に生成 (grid と penalty から構築)
+    };
+
+    // 直近の探索の統計 (計測用)
+    struct SearchStats {
+        int expansions = 0; // Closed にしたセル数
+        int pushes = 0;     // Open リストへの追加回数
+        int pops = 0;       // Open リストからの取り出し回数
+        int decreases = 0;  // Open 中のセルのコスト更新回数
+        qint64 elapsedNs = 0;
+        double suboptimality = 0.0; // Anytime: 経路コストが最適値の何倍以内かの保証値 (他のエンジンでは 0)
+        double heading = 0.0;       // 向きを考慮した C-Space で経路を求めた向き (度)
+    };
+
+    // 1回の探索で書き換える作業領域・統計・中止要求 (探索間で使い回す)
+    // レイヤーは探索中に読むだけなので、作業領域を別々にすれば1つの Pathfinder で並列に探索できる
+    struct SearchContext {
+        SearchWorkspace ws;
+        RadixHeap open;
+
+        // 双方向探索の逆方向側の作業領域と、両側が互いに参照する g コスト
+        SearchWorkspace wsRev;
+        RadixHeap openRev;
+        PublishedCosts published[2];
+
+        // Anytime 探索で各反復の Closed を表す番号 (反復ごとに全セルを開き直すため)
+        std::vector<uint32_t> closedPass;
+        uint32_t pass = 0;
+
+        SearchStats stats;
+        CancelToken cancel; // 実行中の探索の中止要求 (探索の呼び出し中だけ保持する)
+
+        bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
     };
 
-    struct Node {
-        QPoint pos;
-        int gCost = 0;
-        int hCost = 0;
-        Node* parent = nullptr;
-
-        int fCost() const {
-            return gCost + hCost;
-        }
-
-        bool operator>(const Node& other) const {
-            if (fCost() == other.fCost()) {
-                return hCost > other.hCost;
-            }
-            return fCost() > other.fCost();
-        }
+    // 差分再計画する区間の指定 (segment は呼び出し側が区間を識別する番号)
+    struct SegmentQuery {
+        int segment;
+        QPoint start;
+        QPoint goal;
     };
 
     class Pathfinder
@@ -56,18 +133,63 @@ namespace Pathfinding {
 
         // セットアップ
         void setConfig(const PathfinderConfig& config);
+        // 設定を置き換える。障害物は setConfig() のように全体を置き換えず、updateObstacles() と同じく差分更新で反映する
+        void updateConfig(const PathfinderConfig& config);
 
         // 経路探索
         // progressCallback: 0.0 ~ 1.0 の進捗を通知する関数
-        QList<QPoint> findPath(const QPoint& start, const QPoint& goal, std::function<void(float)> progressCallback = nullptr);
+        // cancel: 中止要求 (中止された場合は空のリストを返す)
+        QList<QPoint> findPath(const QPoint& start, const QPoint& goal, std::function<void(float)> progressCallback = nullptr, CancelToken cancel = nullptr);
+
+        // 複数スレッドからの同時探索
+        // prepareSharedSearch() で現在の設定のレイヤー・追加コスト・抽象グラフを用意した後は、findPathShared() を
+        // 任意のスレッドから同時に呼び出せる (レイヤーは読むだけで、作業領域は呼び出しごとに内部のプールから借りる)
+        // 用意してから探索が全て終わるまで、設定の変更・障害物の更新・非 const の探索は行わないこと
+        // findPathShared() は向きを選び直さない (向きを考慮した C-Space では robotAngle の向きだけで探索する)
+        bool prepareSharedSearch();
+        QList<QPoint> findPathShared(const QPoint& start, const QPoint& goal, std::function<void(float)> progressCallback = nullptr,
+            CancelToken cancel = nullptr, SearchStats* stats = nullptr) const;
+
+        // 区間ごとの探索状態を保持する差分再計画 (D* Lite)
+        // segment は呼び出し側が区間を識別する番号。初めての区間 (端点・設定が前回と違う区間) は指定の探索エンジンで求める
+        // 前回から障害物が差分更新された区間は D* Lite で求め直し、以降は変わったセルの影響だけを修正する
+        QList<QPoint> findPathIncremental(int segment, const QPoint& start, const QPoint& goal, CancelToken cancel = nullptr);
+        // 複数区間の差分再計画。区間は互いに独立なので、共有のレイヤーを読み取り専用にして並列に探索する
+        // 結果は queries と同じ順 (見つからなかった区間は空)。進捗は完了した区間の割合で通知する
+        // 中止された場合、探索状態は途中まで修正したまま残り、次回の呼び出しで続きから修正する
+        QList<QList<QPoint>> findPathsIncremental(const QList<SegmentQuery>& queries, std::function<void(float)> progressCallback = nullptr, CancelToken cancel = nullptr);
+        // firstSegment 以降の区間の探索状態を破棄する
+        void discardIncremental(int firstSegment = 0);
+
+        // 可視グラフによる探索 (グリッドを使わない)
+        // 障害物を inflation() だけ膨張した矩形の角を結ぶ可視グラフで、start から goal までの厳密な最短経路を求める
+        // 座標はマップの座標 (mm) で、結果は折れ点の列。グラフは障害物・膨張量・マップが変わるまで使い回す
+        // Safe モードは膨張量だけを反映し (安全距離のペナルティは考慮しない)、向きを考慮した C-Space では全ての向きを含む膨張量を使う
+        QList<QPointF> findVisibilityPath(const QPointF& start, const QPointF& goal);
 
         // C-Space (障害物設定空間) の生成
+        // 障害物・ロボット寸法・閾値・モードが同じなら生成済みレイヤーを再利用する
         void generateConfigurationSpace();
 
-        // ウェイポイント誘導場の生成
+        // ウェイポイント誘導場の生成 (ウェイポイントが変わらなければ再利用)
         void generateWaypointField();
 
-        const std::vector<std::vector<int>>& getGrid() const;
+        // 障害物の差分更新
+        // 膨張後の外接矩形に掛かるセルだけを再ラスタライズし、距離場も局所的に更新する
+        void insertObstacle(int idx, const QRectF& rect);
+        void removeObstacle(int idx);
+        void moveObstacle(int idx, const QRectF& rect);
+
+        // 障害物リストを置き換える。現在のリストとの違いが1件の追加・削除か数件の移動なら差分更新で反映する
+        // 設定 (寸法・モード・向きなど) を変える場合は、先に setConfig() するか updateConfig() を使うこと
+        void updateObstacles(const QList<QRectF>& obstacles);
+
+        // 探索結果を左右する設定のキー (C-Space・追加コスト・探索エンジンとその制御値)
+        // キーと端点が同じなら探索結果も同じになるため、呼び出し側で結果を再利用できる
+        quint64 searchKey() const;
+
+        const OccupancyGrid& getGrid() const;
+        const SearchStats& lastStats() const { return m_ctx.stats; }
         bool isGridPassable(const QPoint& p) const;
         QPoint findNearestPassable(const QPoint& p) const;
 
@@ -79,11 +201,54 @@ namespace Pathfinding {
         QList<QPointF> resampleByArcLength(const QList<QPointF>& pts, double ds) const;
 
     private:
-        // 安全距離場の生成
-        void generateDistanceField();
+        // レイヤーの生成
+        void buildConfigurationSpace(MapLayers& layers) const;
+        void buildDistanceField(MapLayers& layers) const;
+        void rasterizeRegion(OccupancyGrid& grid, const QRect& region, int heading) const;
+        void rasterizeTile(OccupancyGrid& grid, const QRect& tile, const std::vector<int>& obstacles) const;
+        void rasterizeOrientedTile(OccupancyGrid& grid, const QRect& tile, int heading, const std::vector<int>& obstacles) const;
+        void applyEdgeMargin(OccupancyGrid& grid, const QRect& region) const;
+        void generateHeadingStack();
+        void updateDistanceRegion(MapLayers& layers, const QRect& region) const;
+        bool attachLayers();
+        void updateLayersRegion(const QRect& cells);
+
+        qreal inflation() const;
+        QRect inflatedCellRect(const QRectF& r) const;
+        int distanceCap() const;
+        void prepareStepCost();
+        const uint32_t* stepCostLayer() const; // prepareStepCost() 済みであること
+        bool useHierarchical() const;
+        void prepareHierarchy();
+
+        // キャッシュキー (設定値のハッシュ)
+        quint64 layerKey() const;
+        quint64 footprintKey() const; // 向き以外の C-Space の条件
+        int headingIndex() const;
+        quint64 waypointFieldKey() const;
+
+        // レイヤーを準備し、始点・終点を通行可能なセルに補正する
+        bool prepareSearch(const QPoint& start, const QPoint& goal, QPoint& s, QPoint& g);
+        bool prepareLayers();
+        bool snapEndpoints(const QPoint& start, const QPoint& goal, QPoint& s, QPoint& g) const;
+        // concurrent: findPathShared() から他の探索と並列に呼ばれている (Auto で Bidirectional を選ばない)
+        QList<QPoint> searchPrepared(SearchContext& ctx, const QPoint& s, const QPoint& g, const std::function<void(float)>& progressCallback, bool concurrent = false) const;
+
+        // 探索エンジン (s, g は通行可能なセル)。レイヤーは読むだけで、書き換えるのは ctx だけ
+        QList<QPoint> searchAStar(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const;
+        QList<QPoint> searchJumpPoint(SearchContext& ctx, const QPoint& s, const QPoint& g, const std::function<void(float)>& progressCallback) const;
+        QList<QPoint> searchHierarchical(SearchContext& ctx, const QPoint& s, const QPoint& g) const;
+        QList<QPoint> searchAnytime(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const;
+        QList<QPoint> searchAnyAngle(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const;
+        QList<QPoint> searchBidirectional(SearchContext& ctx, const QPoint& s, const QPoint& g, const uint32_t* stepCost, const std::function<void(float)>& progressCallback) const;
+        int corridorLimit(const QPoint& s, const QPoint& g) const;
+        void relax(SearchContext& ctx, int idx, int newG, int parent, int h) const;
 
         int heuristic(const QPoint& a, const QPoint& b) const;
+        int euclidCost(const QPoint& a, const QPoint& b) const; // 直線距離 x10 (任意角度の経路用)
         bool isGridCollisionFree(const QPoint& p1, const QPoint& p2) const;
+        // 線分 a→b のコスト (長さ x10 + 通過セルの追加コスト)。視線が通らなければ -1
+        int lineCost(int a, int b, const uint32_t* stepCost) const;
         bool isWorldPathCollisionFree(const QPointF& p1, const QPointF& p2) const;
         QPointF getCatmullRomPoint(float t, const QPointF& p0, const QPointF& p1, const QPointF& p2, const QPointF& p3, float alpha) const;
 
@@ -91,10 +256,64 @@ namespace Pathfinding {
         int m_gridW = 0;
         int m_gridH = 0;
 
-        // グリッドデータ (0:通行可, 1:障害物, 2:Closed)
-        std::vector<std::vector<int>> m_grid;
-        std::vector<std::vector<int>> m_distField;
-        std::vector<std::vector<int>> m_wpField;
+        // 現在の設定に対応するレイヤー
+        std::shared_ptr<MapLayers> m_layers;
+
+        // レイヤーキャッシュ (先頭ほど最近使用)。Safe/Aggressive を交互に使う区間で再生成を避ける
+        static constexpr int LayerCacheCapacity = 4;
+
+        // C-Space を並列に生成するタイルの最小の辺 (セル)
+        static constexpr int RasterTileSize = 256;
+
+        // updateObstacles() で差分更新する移動の最大件数 (これを超えたら全体を生成し直す)
+        static constexpr size_t MaxIncrementalMoves = 8;
+        std::vector<std::pair<quint64, std::shared_ptr<MapLayers>>> m_layerCache;
+
+        // 向きを考慮した C-Space の全ての向きの占有グリッド (向きを選ぶ探索用に並列に一括生成する)
+        // 差分更新は現在の向きのレイヤーだけに反映し、こちらは footprintKey が変わったら生成し直す
+        struct HeadingStack {
+            quint64 key = 0;
+            std::vector<OccupancyGrid> grids;
+        };
+        HeadingStack m_headingStack;
+        int m_headingOverride = -1; // 0 以上なら robotAngle の代わりに使う向き
+        // m_headingOverride の向きのレイヤー (レイヤーキャッシュとは別に、直近の1つの向きだけを保持する)
+        std::pair<quint64, std::shared_ptr<MapLayers>> m_headingLayers;
+
+        // 展開ループで中止要求を確認する間隔 (Open からの取り出し回数。2の累乗)
+        static constexpr int CancelCheckInterval = 256;
+        static constexpr int JumpCancelCheckInterval = 16; // JPS は1回の展開で直線を走査するため短くする
+
+        // Anytime 探索で1回の改善ごとに下げる ε
+        static constexpr double AnytimeEpsilonStep = 0.25;
+
+        // ウェイポイント誘導場の引き寄せコスト (モードに依存しないためレイヤーとは別に保持)
+        CostGrid m_wpField;
+        quint64 m_wpKey = 0;
+
+        // Safe ペナルティと引き寄せコストの合算 (両方使う場合のみ生成)
+        CostGrid m_stepCost;
+        quint64 m_stepCostKey = 0;
+
+        // findPath() で使い回す作業領域 (マップサイズが変わらない限り再確保しない)
+        SearchContext m_ctx;
+
+        // findPathShared() に貸し出す作業領域 (返却されたものを次の呼び出しで使い回す)
+        mutable QMutex m_contextMutex;
+        mutable std::vector<std::unique_ptr<SearchContext>> m_contextPool;
+
+        // findVisibilityPath() の可視グラフ (footprintKey が変わったら構築し直す)
+        VisibilityGraph m_visibility;
+        quint64 m_visibilityKey = 0;
+
+        // findPathIncremental() の区間ごとの探索状態
+        struct SegmentPlanner {
+            DStarLite planner;
+            std::weak_ptr<MapLayers> layers; // 探索状態が対応するレイヤー (差分更新時に変化範囲を通知する)
+            quint64 costKey = 0;             // 引き寄せコストの組み合わせ
+            bool edited = false;             // 障害物の差分更新があった (planner で再計画する)
+        };
+        std::map<int, SegmentPlanner> m_segmentPlanners;
     };
 
 }
@@ -0,0 +1,112 @@
+﻿#ifndef RADIXHEAP_H
+#define RADIXHEAP_H
+
+#include <QtGlobal>
+#include <QtAlgorithms>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace Pathfinding {
+
+    // 整数キーの単調優先度付きキュー (Radix Heap)
+    // 取り出したキーより小さいキーを積まないこと (A* では f が単調になる無矛盾なヒューリスティックが前提)
+    // キーが単調にならない探索 (Lazy Theta*・ARA*) には使えない
+    // 要素はセルのインデックスで、キーの減少 (decrease-key) に対応するため重複要素を持たない
+    // 同じキーの要素は後に積んだものから取り出す
+    class RadixHeap
+    {
+    public:
+        // 探索開始前に呼ぶ。セル数が変わった時のみ再確保する
+        void reset(int cellCount) {
+            if (int(m_slot.size()) != cellCount) {
+                m_slot.assign(size_t(cellCount), Slot());
+            }
+            for (auto& bucket : m_buckets) bucket.clear();
+            m_last = 0;
+            m_size = 0;
+        }
+
+        bool empty() const { return m_size == 0; }
+        int size() const { return m_size; }
+
+        // キュー内に無い要素を積む
+        void push(int idx, uint32_t key) {
+            Q_ASSERT(key >= m_last);
+            insert({ key, idx });
+            ++m_size;
+        }
+
+        // キュー内の要素のキーを小さくする
+        void decrease(int idx, uint32_t key) {
+            Q_ASSERT(key >= m_last);
+            const Slot& slot = m_slot[size_t(idx)];
+            if (key >= m_buckets[slot.bucket][size_t(slot.pos)].key) return;
+            erase(idx);
+            insert({ key, idx });
+        }
+
+        // キーが最小の要素を取り出す
+        int pop() {
+            if (m_buckets[0].empty()) {
+                size_t b = 1;
+                while (m_buckets[b].empty()) ++b;
+
+                // バケット内の最小キーを新しい基準にして、より下位のバケットへ振り分け直す
+                uint32_t minKey = UINT32_MAX;
+                for (const Entry& e : m_buckets[b]) minKey = std::min(minKey, e.key);
+                m_last = minKey;
+                m_scratch.swap(m_buckets[b]);
+                for (const Entry& e : m_scratch) insert(e);
+                m_scratch.clear();
+            }
+            const int idx = m_buckets[0].back().idx;
+            m_buckets[0].pop_back();
+            --m_size;
+            return idx;
+        }
+
+    private:
+        // 振り分け直しでセル単位の配列を読まずに済むよう、キーはバケット側に持つ
+        struct Entry {
+            uint32_t key;
+            int32_t idx;
+        };
+        struct Slot {
+            int32_t pos = 0;
+            uint8_t bucket = 0;
+        };
+
+        // 最後に取り出したキーと最上位で異なるビットの位置がバケット番号になる
+        int bucketIndex(uint32_t key) const {
+            return key == m_last ? 0 : 32 - int(qCountLeadingZeroBits(key ^ m_last));
+        }
+
+        void insert(const Entry& e) {
+            const int b = bucketIndex(e.key);
+            Slot& slot = m_slot[size_t(e.idx)];
+            slot.bucket = uint8_t(b);
+            slot.pos = int32_t(m_buckets[size_t(b)].size());
+            m_buckets[size_t(b)].push_back(e);
+        }
+
+        void erase(int idx) {
+            const Slot& slot = m_slot[size_t(idx)];
+            std::vector<Entry>& bucket = m_buckets[slot.bucket];
+            const Entry moved = bucket.back();
+            bucket[size_t(slot.pos)] = moved;
+            m_slot[size_t(moved.idx)].pos = slot.pos;
+            bucket.pop_back();
+        }
+
+        std::array<std::vector<Entry>, 33> m_buckets;
+        std::vector<Entry> m_scratch;
+        std::vector<Slot> m_slot;
+        uint32_t m_last = 0;
+        int m_size = 0;
+    };
+
+}
+
+#endif // RADIXHEAP_H
@@ -0,0 +1,123 @@
+﻿#ifndef SEARCHWORKSPACE_H
+#define SEARCHWORKSPACE_H
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+namespace Pathfinding {
+
+    // A* 探索の作業領域
+    // セルごとの g コスト・親インデックス・状態を別々の配列 (SoA) で保持する
+    // 世代番号 (スタンプ) で有効性を判定するため、探索ごとのリセットは O(1)
+    class SearchWorkspace
+    {
+    public:
+        enum State : uint8_t {
+            Unseen = 0,
+            Open = 1,
+            Closed = 2
+        };
+
+        // 探索開始前に呼ぶ。セル数が変わった時のみ再確保する
+        void prepare(int cellCount) {
+            if (int(m_g.size()) != cellCount) {
+                m_g.assign(size_t(cellCount), 0);
+                m_parent.assign(size_t(cellCount), -1);
+                m_stamp.assign(size_t(cellCount), 0);
+                m_state.assign(size_t(cellCount), Unseen);
+                m_gen = 0;
+                ++m_allocations;
+            }
+            if (++m_gen == 0) { // 世代番号が一周したら全スタンプを無効化
+                std::fill(m_stamp.begin(), m_stamp.end(), 0u);
+                m_gen = 1;
+            }
+        }
+
+        bool isSeen(int idx) const { return m_stamp[size_t(idx)] == m_gen; }
+        State state(int idx) const { return isSeen(idx) ? State(m_state[size_t(idx)]) : Unseen; }
+        bool isClosed(int idx) const { return state(idx) == Closed; }
+
+        int32_t g(int idx) const { return m_g[size_t(idx)]; }
+        int32_t parent(int idx) const { return m_parent[size_t(idx)]; }
+
+        // g コストと親を設定して Open にする
+        void open(int idx, int32_t g, int32_t parent) {
+            m_stamp[size_t(idx)] = m_gen;
+            m_g[size_t(idx)] = g;
+            m_parent[size_t(idx)] = parent;
+            m_state[size_t(idx)] = Open;
+        }
+
+        void close(int idx) { m_state[size_t(idx)] = Closed; }
+
+        // 確保済みメモリ量と再確保回数 (計測用)
+        size_t memoryBytes() const {
+            return m_g.size() * sizeof(int32_t) + m_parent.size() * sizeof(int32_t)
+                + m_stamp.size() * sizeof(uint32_t) + m_state.size() * sizeof(uint8_t);
+        }
+        int allocations() const { return m_allocations; }
+
+    private:
+        std::vector<int32_t> m_g;
+        std::vector<int32_t> m_parent;
+        std::vector<uint32_t> m_stamp;
+        std::vector<uint8_t> m_state;
+        uint32_t m_gen = 0;
+        int m_allocations = 0;
+    };
+
+    // 双方向探索で相手側のスレッドに公開する g コスト
+    // 世代番号と g を1語にまとめて原子的に読み書きするため、ロック無しで参照できる
+    class PublishedCosts
+    {
+    public:
+        // 探索開始前 (両側のスレッドを起動する前) に呼ぶ
+        void prepare(int cellCount) {
+            if (m_size != cellCount) {
+                m_cells.reset(new std::atomic<uint64_t>[size_t(cellCount)]);
+                m_size = cellCount;
+                m_gen = 0;
+                clear();
+            }
+            if (++m_gen == 0) {
+                clear();
+                m_gen = 1;
+            }
+        }
+
+        // closed: この側で確定済み (g が最適値) であることを示す
+        void publish(int idx, int32_t g, bool closed = false) {
+            m_cells[size_t(idx)].store((uint64_t(m_gen) << 32) | (closed ? ClosedBit : 0u) | uint32_t(g));
+        }
+
+        // 今回の探索で公開済みなら g と確定済みかどうかを返す
+        bool read(int idx, int32_t& g, bool& closed) const {
+            const uint64_t v = m_cells[size_t(idx)].load();
+            if (uint32_t(v >> 32) != m_gen) return false;
+            closed = (uint32_t(v) & ClosedBit) != 0;
+            g = int32_t(uint32_t(v) & ~ClosedBit);
+            return true;
+        }
+
+        size_t memoryBytes() const { return size_t(m_size) * sizeof(uint64_t); }
+
+    private:
+        static constexpr uint32_t ClosedBit = 0x80000000u;
+
+        void clear() {
+            for (int i = 0; i < m_size; ++i) m_cells[size_t(i)].store(0, std::memory_order_relaxed);
+        }
+
+        std::unique_ptr<std::atomic<uint64_t>[]> m_cells;
+        int m_size = 0;
+        uint32_t m_gen = 0;
+    };
+
+}
+
+#endif // SEARCHWORKSPACE_H
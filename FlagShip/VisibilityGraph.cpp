@@ -0,0 +1,227 @@
+﻿#include "VisibilityGraph.h"
+#include "Parallel.h"
+#include <queue>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace Pathfinding {
+
+    namespace {
+        // 角のノードを矩形の外側へずらす量 (mm)。辺に沿う経路が矩形に触れたと判定されないようにする
+        constexpr double CornerOffset = 0.01;
+
+        double distance(const QPointF& a, const QPointF& b)
+        {
+            return std::hypot(a.x() - b.x(), a.y() - b.y());
+        }
+
+        // 線分 ab が矩形 r (境界を含む) と交わるか
+        // 境界も通れないものとするため、接する・重なる矩形の継ぎ目や角の接点を線分がすり抜けることはない
+        bool intersectsRect(const QRectF& r, const QPointF& a, const QPointF& b)
+        {
+            if (std::max(a.x(), b.x()) < r.left() || std::min(a.x(), b.x()) > r.right()) return false;
+            if (std::max(a.y(), b.y()) < r.top() || std::min(a.y(), b.y()) > r.bottom()) return false;
+
+            // 線分を矩形の各軸の閉区間で切り取り、範囲が残れば交わる
+            double t0 = 0.0, t1 = 1.0;
+            auto clip = [&](double p, double d, double lo, double hi) {
+                if (d == 0.0) return p >= lo && p <= hi;
+                double u = (lo - p) / d;
+                double v = (hi - p) / d;
+                if (u > v) std::swap(u, v);
+                t0 = std::max(t0, u);
+                t1 = std::min(t1, v);
+                return t0 <= t1;
+            };
+            if (!clip(a.x(), b.x() - a.x(), r.left(), r.right())) return false;
+            return clip(a.y(), b.y() - a.y(), r.top(), r.bottom());
+        }
+    }
+
+    void VisibilityGraph::build(const QList<QRectF>& obstacles, qreal inflate, const QRectF& bounds)
+    {
+        m_bounds = bounds;
+        m_rects.clear();
+        m_nodes.clear();
+        m_edges.clear();
+        m_built = true;
+
+        for (const QRectF& r : obstacles) {
+            const QRectF infR = r.normalized().adjusted(-inflate, -inflate, inflate, inflate);
+            if (infR.width() <= 0 || infR.height() <= 0) continue;
+            m_rects.push_back(infR);
+        }
+
+        // 他の矩形に埋もれた角・マップの通行範囲外の角は経路に使えない
+        for (const QRectF& r : m_rects) {
+            const Node corners[] = {
+                { QPointF(r.left() - CornerOffset, r.top() - CornerOffset), -1, -1 },
+                { QPointF(r.right() + CornerOffset, r.top() - CornerOffset), 1, -1 },
+                { QPointF(r.left() - CornerOffset, r.bottom() + CornerOffset), -1, 1 },
+                { QPointF(r.right() + CornerOffset, r.bottom() + CornerOffset), 1, 1 },
+            };
+            for (const Node& c : corners) {
+                if (isFree(c.pos)) m_nodes.push_back(c);
+            }
+        }
+
+        // 角同士の可視判定は互いに独立なので並列に行い、j > i の辺を集めてから両向きに登録する
+        const int n = int(m_nodes.size());
+        std::vector<std::vector<Edge>> forward(static_cast<size_t>(n));
+        parallelFor(0, n, [&](int i) {
+            const Node& a = m_nodes[size_t(i)];
+            for (int j = i + 1; j < n; ++j) {
+                const Node& b = m_nodes[size_t(j)];
+                if (!isTangent(a, b.pos) || !isTangent(b, a.pos)) continue;
+                if (!isVisible(a.pos, b.pos)) continue;
+                forward[size_t(i)].push_back({ j, distance(a.pos, b.pos) });
+            }
+        }, 4);
+
+        m_edges.assign(size_t(n), {});
+        for (int i = 0; i < n; ++i) {
+            for (const Edge& e : forward[size_t(i)]) {
+                m_edges[size_t(i)].push_back(e);
+                m_edges[size_t(e.to)].push_back({ i, e.cost });
+            }
+        }
+    }
+
+    int VisibilityGraph::edgeCount() const
+    {
+        size_t count = 0;
+        for (const auto& edges : m_edges) count += edges.size();
+        return int(count / 2);
+    }
+
+    bool VisibilityGraph::isFree(const QPointF& p) const
+    {
+        if (p.x() < m_bounds.left() || p.x() > m_bounds.right() || p.y() < m_bounds.top() || p.y() > m_bounds.bottom()) return false;
+        for (const QRectF& r : m_rects) {
+            if (p.x() >= r.left() && p.x() <= r.right() && p.y() >= r.top() && p.y() <= r.bottom()) return false;
+        }
+        return true;
+    }
+
+    bool VisibilityGraph::isVisible(const QPointF& a, const QPointF& b) const
+    {
+        // 端点が通行範囲 (凸) 内にあれば線分も範囲内にあるため、矩形だけを調べる
+        for (const QRectF& r : m_rects) {
+            if (intersectsRect(r, a, b)) return false;
+        }
+        return true;
+    }
+
+    bool VisibilityGraph::isTangent(const Node& node, const QPointF& other)
+    {
+        // 角を通る直線が矩形側の象限 (-sx, -sy) に入らなければ接線
+        // ノードは角から CornerOffset だけ離れているため、辺とほぼ平行な直線 (辺上の点との間など) も接線とみなす
+        const double dx = other.x() - node.pos.x();
+        const double dy = other.y() - node.pos.y();
+        if (std::min(std::abs(dx), std::abs(dy)) <= 2 * CornerOffset) return true;
+        return dx * dy * node.sx * node.sy <= 0.0;
+    }
+
+    bool VisibilityGraph::pushOut(QPointF& p) const
+    {
+        p.setX(qBound(m_bounds.left(), p.x(), m_bounds.right()));
+        p.setY(qBound(m_bounds.top(), p.y(), m_bounds.bottom()));
+        if (isFree(p)) return true;
+
+        // 通れる領域の境界は矩形の辺 (外側へずらした線) と通行範囲の縁からなるため、最も近い通れる点は
+        // それらの縦線への p からの射影、横線への射影、縦線と横線の交点のいずれかになる。近い順に調べる
+        std::vector<double> xs = { p.x(), m_bounds.left(), m_bounds.right() };
+        std::vector<double> ys = { p.y(), m_bounds.top(), m_bounds.bottom() };
+        for (const QRectF& r : m_rects) {
+            xs.push_back(r.left() - CornerOffset);
+            xs.push_back(r.right() + CornerOffset);
+            ys.push_back(r.top() - CornerOffset);
+            ys.push_back(r.bottom() + CornerOffset);
+        }
+        std::vector<std::pair<double, QPointF>> candidates;
+        candidates.reserve(xs.size() * ys.size());
+        for (double x : xs) {
+            for (double y : ys) {
+                const QPointF c(x, y);
+                candidates.push_back({ distance(p, c), c });
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+            [](const std::pair<double, QPointF>& a, const std::pair<double, QPointF>& b) { return a.first < b.first; });
+        for (const auto& c : candidates) {
+            if (isFree(c.second)) {
+                p = c.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    QList<QPointF> VisibilityGraph::findPath(const QPointF& start, const QPointF& goal, int* expansions) const
+    {
+        if (expansions) *expansions = 0;
+        if (!m_built) return {};
+
+        QPointF s = start;
+        QPointF g = goal;
+        if (!pushOut(s) || !pushOut(g)) return {};
+        if (isVisible(s, g)) return { s, g };
+
+        // 角のノードに始点 (n) と終点 (n + 1) を加えて A* で探索する
+        const int n = int(m_nodes.size());
+        const int startNode = n;
+        const int goalNode = n + 1;
+        auto position = [&](int v) { return v == startNode ? s : (v == goalNode ? g : m_nodes[size_t(v)].pos); };
+
+        std::vector<char> toGoal(size_t(n), 0);
+        parallelFor(0, n, [&](int i) {
+            const Node& node = m_nodes[size_t(i)];
+            toGoal[size_t(i)] = isTangent(node, g) && isVisible(node.pos, g);
+        }, 16);
+
+        std::vector<double> cost(size_t(n) + 2, std::numeric_limits<double>::infinity());
+        std::vector<int> parent(size_t(n) + 2, -1);
+        std::vector<char> closed(size_t(n) + 2, 0);
+        using Entry = std::pair<double, int>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+
+        auto relax = [&](int from, int to, double step) {
+            const double c = cost[size_t(from)] + step;
+            if (c >= cost[size_t(to)]) return;
+            cost[size_t(to)] = c;
+            parent[size_t(to)] = from;
+            open.push({ c + distance(position(to), g), to });
+        };
+
+        cost[size_t(startNode)] = 0.0;
+        open.push({ distance(s, g), startNode });
+        while (!open.empty()) {
+            const int v = open.top().second;
+            open.pop();
+            if (closed[size_t(v)]) continue;
+            closed[size_t(v)] = 1;
+            if (expansions) ++*expansions;
+            if (v == goalNode) break;
+
+            if (v == startNode) {
+                // 始点からの辺はその都度求める
+                for (int i = 0; i < n; ++i) {
+                    const Node& node = m_nodes[size_t(i)];
+                    if (isTangent(node, s) && isVisible(s, node.pos)) relax(v, i, distance(s, node.pos));
+                }
+                continue;
+            }
+            for (const Edge& e : m_edges[size_t(v)]) {
+                if (!closed[size_t(e.to)]) relax(v, e.to, e.cost);
+            }
+            if (toGoal[size_t(v)]) relax(v, goalNode, distance(m_nodes[size_t(v)].pos, g));
+        }
+
+        if (parent[size_t(goalNode)] < 0) return {};
+        QList<QPointF> path;
+        for (int v = goalNode; v >= 0; v = parent[size_t(v)]) path.prepend(position(v));
+        return path;
+    }
+
+}
@@ -0,0 +1,58 @@
+﻿#ifndef VISIBILITYGRAPH_H
+#define VISIBILITYGRAPH_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QList>
+#include <vector>
+
+namespace Pathfinding {
+
+    // 軸に平行な矩形障害物の可視グラフ
+    // 膨張後の矩形の角をノード、互いに見通せる角同士を辺 (長さはユークリッド距離) とし、
+    // 始点・終点をその都度つないで A* で厳密な最短経路 (折れ点の列) を求める
+    // 最短経路は角に接して曲がるため、角で矩形に接しない向きの辺 (接線にならない辺) は持たない
+    //
+    // 座標はマップの座標 (mm)。矩形 (境界を含む) とマップの通行範囲の外を通れない領域とする
+    // 接する・重なる矩形は境界を共有するため、その継ぎ目は通れない
+    class VisibilityGraph
+    {
+    public:
+        // obstacles を inflate だけ膨張した矩形と、bounds の外を通れない領域として構築する
+        void build(const QList<QRectF>& obstacles, qreal inflate, const QRectF& bounds);
+
+        // start から goal までの最短経路。見つからなければ空のリスト
+        // 通れない位置にある端点は、最寄りの矩形の外側 (マップの通行範囲内) へ移してから探索する
+        // expansions には展開したノード数を返す
+        QList<QPointF> findPath(const QPointF& start, const QPointF& goal, int* expansions = nullptr) const;
+
+        bool isBuilt() const { return m_built; }
+        int nodeCount() const { return int(m_nodes.size()); }
+        int edgeCount() const;
+
+    private:
+        struct Node {
+            QPointF pos;
+            int sx; // 角から矩形の外へ向かう向き (-1 / +1)
+            int sy;
+        };
+        struct Edge {
+            int to;
+            double cost;
+        };
+
+        bool isFree(const QPointF& p) const;
+        bool isVisible(const QPointF& a, const QPointF& b) const;
+        static bool isTangent(const Node& node, const QPointF& other);
+        bool pushOut(QPointF& p) const;
+
+        std::vector<QRectF> m_rects; // 膨張後の矩形
+        std::vector<Node> m_nodes;
+        std::vector<std::vector<Edge>> m_edges;
+        QRectF m_bounds;
+        bool m_built = false;
+    };
+
+}
+
+#endif // VISIBILITYGRAPH_H
@@ -13,14 +13,14 @@ AddObstacleCommand::AddObstacleCommand(MapView* map, const QRectF& obs, QUndoCom
 void AddObstacleCommand::undo()
 {
     m_map->m_obs.removeLast();
-    m_map->regeneratePathfinderGrid();
+    m_map->pathfinderObstacleRemoved(m_map->m_obs.size());
     m_map->update();
 }
 
 void AddObstacleCommand::redo()
 {
     m_map->m_obs.append(m_obs);
-    m_map->regeneratePathfinderGrid();
+    m_map->pathfinderObstacleInserted(m_map->m_obs.size() - 1);
     m_map->update();
 }
 
@@ -40,7 +40,7 @@ void DeleteObstacleCommand::undo()
 {
     if (m_idx >= 0 && m_idx <= m_map->m_obs.size()) {
         m_map->m_obs.insert(m_idx, m_obs);
-        m_map->regeneratePathfinderGrid();
+        m_map->pathfinderObstacleInserted(m_idx);
         m_map->update();
     }
 }
@@ -49,7 +49,7 @@ void DeleteObstacleCommand::redo()
 {
     if (m_idx >= 0 && m_idx < m_map->m_obs.size()) {
         m_map->m_obs.removeAt(m_idx);
-        m_map->regeneratePathfinderGrid();
+        m_map->pathfinderObstacleRemoved(m_idx);
         m_map->update();
     }
 }
@@ -67,7 +67,7 @@ void MoveObstacleCommand::undo()
 {
     if (m_idx >= 0 && m_idx < m_map->m_obs.size()) {
         m_map->m_obs[m_idx] = m_oldRect;
-        m_map->regeneratePathfinderGrid();
+        m_map->pathfinderObstacleMoved(m_idx);
         m_map->update();
     }
 }
@@ -76,7 +76,7 @@ void MoveObstacleCommand::redo()
 {
     if (m_idx >= 0 && m_idx < m_map->m_obs.size()) {
         m_map->m_obs[m_idx] = m_newRect;
-        m_map->regeneratePathfinderGrid();
+        m_map->pathfinderObstacleMoved(m_idx);
         m_map->update();
     }
 }
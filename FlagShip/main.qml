@@ -138,13 +138,20 @@ ApplicationWindow {
                         font.pixelSize: 12
                         Layout.alignment: Qt.AlignHCenter
                     }
+
+                    Button {
+                        text: qsTr("Cancel")
+                        onClicked: map.cancelFindPath()
+                        Layout.alignment: Qt.AlignHCenter
+                    }
                 }
             }
             
             // --- 追加箇所 2: 探索中の操作ブロック ---
             MouseArea {
                 anchors.fill: parent
-                visible: map.isFindingPath
+                // 置き換えモードでは探索中も編集できる (Find Path で実行中の探索を中止して探索し直す)
+                visible: map.isFindingPath && !map.supersedeSearch
                 hoverEnabled: true
                 onPressed: (mouse) => { mouse.accepted = true; } // 入力を吸い取る
                 onWheel: (wheel) => { wheel.accepted = true; }
@@ -160,7 +167,7 @@ ApplicationWindow {
                 property point pressPos: Qt.point(0,0)
 
                 // 操作ブロック中は無効化
-                enabled: !map.isFindingPath
+                enabled: !map.isFindingPath || map.supersedeSearch
 
                 onPositionChanged: (mouse) => {
                     if (mouse.buttons & (Qt.RightButton | Qt.MiddleButton)) {
@@ -420,6 +427,67 @@ ApplicationWindow {
                         }
                     }
 
+                    CheckBox {
+                        id: chkAnyAngle
+                        text: qsTr("Any-angle Path")
+                        checked: map.anyAnglePath
+                        onCheckedChanged: map.anyAnglePath = checked
+                        contentItem: Text {
+                            text: parent.text;
+                            font: parent.font; color: theme.textCol
+                            verticalAlignment: Text.AlignVCenter
+                            leftPadding: parent.indicator.width + parent.spacing
+                        }
+                    }
+                    CheckBox {
+                        id: chkVisibility
+                        text: qsTr("Visibility Graph")
+                        checked: map.visibilityGraph
+                        onCheckedChanged: map.visibilityGraph = checked
+                        contentItem: Text {
+                            text: parent.text;
+                            font: parent.font; color: theme.textCol
+                            verticalAlignment: Text.AlignVCenter
+                            leftPadding: parent.indicator.width + parent.spacing
+                        }
+                    }
+                    CheckBox {
+                        id: chkOriented
+                        text: qsTr("Oriented Footprint")
+                        checked: map.orientedFootprint
+                        onCheckedChanged: map.orientedFootprint = checked
+                        contentItem: Text {
+                            text: parent.text;
+                            font: parent.font; color: theme.textCol
+                            verticalAlignment: Text.AlignVCenter
+                            leftPadding: parent.indicator.width + parent.spacing
+                        }
+                    }
+                    CheckBox {
+                        id: chkSupersede
+                        text: qsTr("Restart Running Search")
+                        checked: map.supersedeSearch
+                        onCheckedChanged: map.supersedeSearch = checked
+                        contentItem: Text {
+                            text: parent.text;
+                            font: parent.font; color: theme.textCol
+                            verticalAlignment: Text.AlignVCenter
+                            leftPadding: parent.indicator.width + parent.spacing
+                        }
+                    }
+                    CheckBox {
+                        id: chkLive
+                        text: qsTr("Live Replanning")
+                        checked: map.liveReplan
+                        onCheckedChanged: map.liveReplan = checked
+                        contentItem: Text {
+                            text: parent.text;
+                            font: parent.font; color: theme.textCol
+                            verticalAlignment: Text.AlignVCenter
+                            leftPadding: parent.indicator.width + parent.spacing
+                        }
+                    }
+
                     Rectangle { height: 1; color: theme.inpBorder; Layout.fillWidth: true; Layout.topMargin: 10; Layout.bottomMargin: 5 }
 
                     Label { text: qsTr("Display & Edit"); color: theme.textCol; font.pixelSize: 16; }
@@ -586,8 +654,8 @@ ApplicationWindow {
                         // 探索中はテキスト変更
                         text: map.isFindingPath ? qsTr("Finding...") : qsTr("Find Path")
                         onClicked: map.findPath()
-                        // 探索中は無効化
-                        enabled: !map.isFindingPath
+                        // 探索中は無効化 (置き換えモードでは押すと探索し直す)
+                        enabled: !map.isFindingPath || map.supersedeSearch
                         Layout.topMargin: 5
                         font.bold: true
                     }
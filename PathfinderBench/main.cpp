@@ -0,0 +1,205 @@
+﻿#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <cstdio>
+#include <iterator>
+#include <random>
+
+#include "Pathfinder.h"
+
+// A* の展開速度 (expansions/s) を測るマイクロベンチマーク
+//
+// 使い方: PathfinderBench [マップの辺 (セル, 既定 2000)] [1条件あたりの探索回数 (既定 5)]
+// 固定シードの障害物を置いたマップで、対角の2組の始点・終点を探索する。レイヤーは最初の1回で生成し (計測しない)、
+// 以降の探索時間と lastStats() の展開数から1コアあたりの展開速度を求める
+//
+// 変更前後の比較: 同じ引数で変更前後のソースからそれぞれビルドして実行する
+// lastStats() と探索エンジンの指定が無いソースでは PATHFINDER_BENCH_LEGACY を定義してビルドする (時間だけを表示する)
+// 探索の順序を変えない変更なら展開数は変わらないため、変更前の展開速度は変更後の展開数を変更前の時間で割って求める
+//
+// PathfinderBench --check: 設定の変更と障害物の差分更新を繰り返した Pathfinder が、同じ設定で作り直したものと
+// 同じ占有グリッド・経路を返すかを確かめる (不一致があれば 1 を返す)
+
+namespace {
+
+    struct Scenario {
+        const char* name;
+        int mode; // 0:Safe, 1:Aggressive
+        bool useWpField;
+    };
+
+    Pathfinding::PathfinderConfig makeConfig(int size, const Scenario& sc)
+    {
+        Pathfinding::PathfinderConfig cfg;
+        cfg.mapW = size;
+        cfg.mapH = size;
+        cfg.resolution = 10;
+        cfg.robotW = 100;
+        cfg.robotH = 100;
+        cfg.mode = sc.mode;
+        cfg.safeThresh = 1.5f;
+        cfg.edgeThresh = 50;
+        cfg.useWpField = sc.useWpField;
+#ifndef PATHFINDER_BENCH_LEGACY
+        // 内側のループを比べるため、エンジンを A* に固定する (Auto は JPS・双方向探索を選ぶ)
+        cfg.algorithm = Pathfinding::SearchAlgorithm::AStar;
+#endif
+
+        // 障害物の配置はシード固定 (変更前後で同じマップにする)
+        std::mt19937 rng(42);
+        const int extent = size * cfg.resolution;
+        for (int i = 0; i < 150; ++i) {
+            const int x = int(rng() % uint32_t(extent)) / cfg.resolution * cfg.resolution;
+            const int y = int(rng() % uint32_t(extent)) / cfg.resolution * cfg.resolution;
+            cfg.obstacles.append(QRectF(x, y, 100 + rng() % 800, 100 + rng() % 800));
+        }
+        cfg.waypoints.append(QPointF(extent / 2.0, extent / 2.0));
+        return cfg;
+    }
+
+#ifndef PATHFINDER_BENCH_LEGACY
+    bool sameGrid(const Pathfinding::OccupancyGrid& a, const Pathfinding::OccupancyGrid& b)
+    {
+        if (a.width() != b.width() || a.height() != b.height()) return false;
+        for (int y = 0; y < a.height(); ++y) {
+            for (int x = 0; x < a.width(); ++x) {
+                if (a.at(x, y) != b.at(x, y)) return false;
+            }
+        }
+        return true;
+    }
+
+    // モード・解像度・向き・ロボット寸法の変更と障害物の追加・削除・移動を同時に行い、updateConfig() で反映した結果を
+    // setConfig() で作り直した結果と比べる
+    int runConsistencyCheck()
+    {
+        std::mt19937 rng(5);
+        int checks = 0;
+        int mismatches = 0;
+        for (int t = 0; t < 30; ++t) {
+            Pathfinding::PathfinderConfig cfg;
+            cfg.mapW = 120;
+            cfg.mapH = 110;
+            cfg.resolution = 10;
+            cfg.robotW = 120;
+            cfg.robotH = 80;
+            cfg.mode = 0;
+            cfg.safeThresh = 1.3f;
+            cfg.edgeThresh = 20;
+            cfg.useWpField = false;
+            cfg.orientedFootprint = t % 3 == 0;
+            cfg.algorithm = Pathfinding::SearchAlgorithm::AStar; // 双方向探索は同じコストでも経路がスレッドの進み方で変わる
+            auto randomRect = [&]() {
+                const uint32_t w = uint32_t(cfg.mapW * cfg.resolution);
+                const uint32_t h = uint32_t(cfg.mapH * cfg.resolution);
+                return QRectF(rng() % w, rng() % h, 30 + rng() % 200, 30 + rng() % 200);
+            };
+            for (int i = 0; i < 8; ++i) cfg.obstacles.append(randomRect());
+
+            Pathfinding::Pathfinder incremental;
+            for (int k = 0; k < 25; ++k) {
+                switch (rng() % 5) {
+                case 0: cfg.mode = 1 - cfg.mode; break;
+                case 1: {
+                    const int res = rng() % 2 ? 10 : 8;
+                    cfg.mapW = cfg.mapW * cfg.resolution / res;
+                    cfg.mapH = cfg.mapH * cfg.resolution / res;
+                    cfg.resolution = res;
+                    break;
+                }
+                case 2: cfg.robotAngle = float(rng() % 180); break;
+                case 3: cfg.robotW = float(80 + rng() % 100); break;
+                default: break;
+                }
+                const int count = int(cfg.obstacles.size());
+                const uint32_t op = rng() % 3;
+                if (op == 0 || count == 0) {
+                    cfg.obstacles.insert(int(rng() % uint32_t(count + 1)), randomRect());
+                }
+                else if (op == 1) {
+                    cfg.obstacles.removeAt(int(rng() % uint32_t(count)));
+                }
+                else {
+                    QRectF& r = cfg.obstacles[int(rng() % uint32_t(count))];
+                    r.translate(QPointF(int(rng() % 30) - 15, int(rng() % 30) - 15));
+                }
+
+                const QPoint s(int(rng() % uint32_t(cfg.mapW)), int(rng() % uint32_t(cfg.mapH)));
+                const QPoint g(int(rng() % uint32_t(cfg.mapW)), int(rng() % uint32_t(cfg.mapH)));
+                incremental.updateConfig(cfg);
+                const QList<QPoint> path = incremental.findPath(s, g);
+
+                Pathfinding::Pathfinder fresh;
+                fresh.setConfig(cfg);
+                const QList<QPoint> expected = fresh.findPath(s, g);
+
+                ++checks;
+                if (path != expected || !sameGrid(incremental.getGrid(), fresh.getGrid())) {
+                    ++mismatches;
+                    std::printf("mismatch: map %d, step %d\n", t, k);
+                }
+            }
+        }
+        std::printf("consistency: %d checks, %d mismatches\n", checks, mismatches);
+        return mismatches == 0 ? 0 : 1;
+    }
+#endif
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+#ifndef PATHFINDER_BENCH_LEGACY
+    if (args.size() > 1 && args[1] == "--check") return runConsistencyCheck();
+#endif
+    const int size = args.size() > 1 ? qMax(100, args[1].toInt()) : 2000;
+    const int repeat = args.size() > 2 ? qMax(1, args[2].toInt()) : 5;
+
+    const Scenario scenarios[] = {
+        { "Safe", 0, false },
+        { "Safe + waypoints", 0, true },
+        { "Aggressive", 1, false },
+        { "Aggressive + waypoints", 1, true },
+    };
+    const QPoint queries[][2] = {
+        { QPoint(10, 10), QPoint(size - 10, size - 10) },
+        { QPoint(size - 10, 10), QPoint(10, size - 10) },
+    };
+
+    std::printf("map %d x %d, %d runs per scenario\n", size, size, repeat);
+    for (const Scenario& sc : scenarios) {
+        Pathfinding::Pathfinder finder;
+        finder.setConfig(makeConfig(size, sc));
+
+        // レイヤー・誘導場の生成は計測に含めない
+        finder.findPath(queries[0][0], queries[0][1]);
+
+        qint64 elapsedNs = 0;
+        qint64 expansions = 0;
+        int found = 0;
+        for (int r = 0; r < repeat; ++r) {
+            for (const auto& q : queries) {
+                QElapsedTimer timer;
+                timer.start();
+                const QList<QPoint> path = finder.findPath(q[0], q[1]);
+                elapsedNs += timer.nsecsElapsed();
+                if (!path.isEmpty()) ++found;
+#ifndef PATHFINDER_BENCH_LEGACY
+                expansions += finder.lastStats().expansions;
+#endif
+            }
+        }
+
+        const int runs = repeat * int(std::size(queries));
+        const double ms = elapsedNs / 1e6 / runs;
+#ifndef PATHFINDER_BENCH_LEGACY
+        std::printf("%-24s %8.2f ms/query  %10lld expansions/query  %6.2f M expansions/s  (found %d/%d)\n",
+            sc.name, ms, static_cast<long long>(expansions / runs), expansions / (elapsedNs / 1e9) / 1e6, found, runs);
+#else
+        std::printf("%-24s %8.2f ms/query  (found %d/%d)\n", sc.name, ms, found, runs);
+#endif
+    }
+    return 0;
+}